@@ -0,0 +1,65 @@
+#include <functional>
+#include <stdexcept>
+#include "effects/effects.h"
+#include "bench.h"
+
+/**
+ * Baselines for the other benchmarks: a tail-resumptive effect compared to calling a
+ * std::function, and aborting a computation with an effect compared to throwing an exception.
+ */
+
+using namespace effects;
+
+static const size_t iterations = 1000000;
+static const size_t abort_iterations = 100000;
+
+Effect<int (int)> tail_effect;
+Effect<int (int)> abort_effect;
+
+Handler<int, int> handler{
+	{
+		{ tail_effect, [](int x) { return x + 1; } },
+		{ abort_effect, [](int x, const One_Shot_Continuation<int, int> &) { return x; } }
+	}
+};
+
+std::function<int (int)> function = [](int x) { return x + 1; };
+
+__attribute__((noinline)) static int throw_value(int x) {
+	throw x;
+}
+
+int main() {
+	bench::report("baseline", "std::function", bench::measure(iterations, []() {
+		int x = 0;
+		for (size_t i = 0; i < iterations; i++)
+			x = function(x);
+		bench::keep(x);
+	}));
+
+	bench::report("baseline", "tail-resumptive effect", bench::measure(iterations, []() {
+		bench::keep(handle(handler, []() {
+			int x = 0;
+			for (size_t i = 0; i < iterations; i++)
+				x = tail_effect(+x);
+			return x;
+		}));
+	}));
+
+	bench::report("baseline", "exception", bench::measure(abort_iterations, []() {
+		for (size_t i = 0; i < abort_iterations; i++) {
+			try {
+				throw_value(int(i));
+			} catch (int x) {
+				bench::keep(x);
+			}
+		}
+	}));
+
+	bench::report("baseline", "abort with effect", bench::measure(abort_iterations, []() {
+		for (size_t i = 0; i < abort_iterations; i++)
+			bench::keep(handle(handler, [i]() { return abort_effect(int(i)); }));
+	}));
+
+	return 0;
+}
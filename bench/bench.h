@@ -0,0 +1,61 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <initializer_list>
+#include <utility>
+
+/**
+ * Minimal benchmark harness shared by the programs in this directory.
+ *
+ * Each result is written to stdout as one JSON object per line, so that the output of two runs can
+ * be compared with diff or loaded by other tools. "make bench" collects the output of all
+ * benchmarks in $(BUILDDIR)/bench/results.jsonl.
+ */
+
+namespace bench {
+
+	using Clock = std::chrono::steady_clock;
+
+	// Number of times each measurement is repeated. The fastest repetition is reported, as it is
+	// the least disturbed by the rest of the system.
+	static const int repetitions = 5;
+
+	// Measure the time of "fn", which performs "ops" operations. Returns nanoseconds per operation.
+	template <typename Function>
+	double measure(size_t ops, Function &&fn) {
+		// Warm up caches and the stack pool.
+		fn();
+
+		double best = 0;
+		for (int i = 0; i < repetitions; i++) {
+			Clock::time_point start = Clock::now();
+			fn();
+			double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+			if (i == 0 || ns < best)
+				best = ns;
+		}
+		return best / ops;
+	}
+
+	// Keep the compiler from optimizing away a value.
+	template <typename T>
+	void keep(const T &value) {
+		__asm__ volatile ("" : : "g" (&value) : "memory");
+	}
+
+	// A named parameter of a result.
+	using Param = std::pair<const char *, double>;
+
+	// Write a result. "benchmark" is the name of the program, "name" the name of the measurement.
+	inline void report(const char *benchmark, const char *name, double ns_per_op,
+					std::initializer_list<Param> params = {}) {
+		std::printf("{\"benchmark\": \"%s\", \"name\": \"%s\", \"ns_per_op\": %.2f",
+					benchmark, name, ns_per_op);
+		for (const Param &p : params)
+			std::printf(", \"%s\": %.10g", p.first, p.second);
+		std::printf("}\n");
+		std::fflush(stdout);
+	}
+
+}
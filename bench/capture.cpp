@@ -0,0 +1,60 @@
+#include "effects/effects.h"
+#include "bench.h"
+
+/**
+ * Measures the cost of capturing and resuming a continuation depending on how much of the stack
+ * is in use when the effect is performed. Multi-shot continuations copy the used part of the
+ * stack, one-shot continuations do not.
+ */
+
+using namespace effects;
+
+static const size_t rounds = 5000;
+
+// Approximate stack usage of each level of recursion.
+static const size_t frame_size = 256;
+
+Effect<int (int)> one_shot_effect;
+Effect<int (int)> multi_shot_effect;
+
+Handler<int, int> handler{
+	{
+		{ one_shot_effect, [](int x, const One_Shot_Continuation<int, int> &cont) { return cont(x); } },
+		{ multi_shot_effect, [](int x, const Continuation<int, int> &cont) { return cont(x); } }
+	}
+};
+
+// Recurse "depth" times, then call "fn".
+template <typename Function>
+__attribute__((noinline)) int recurse(size_t depth, const Function &fn) {
+	volatile char pad[frame_size - 32];
+	pad[0] = 1;
+	if (depth == 0)
+		return fn();
+	return recurse(depth - 1, fn) + pad[0];
+}
+
+template <typename Signature>
+static void run(const char *name, Effect<Signature> &effect, size_t bytes) {
+	size_t depth = bytes / frame_size;
+
+	double total = bench::measure(rounds, [&effect, depth]() {
+		for (size_t r = 0; r < rounds; r++)
+			bench::keep(handle(handler, [&effect, depth]() { return recurse(depth, [&effect]() { return effect(1); }); }));
+	});
+
+	double setup = bench::measure(rounds, [depth]() {
+		for (size_t r = 0; r < rounds; r++)
+			bench::keep(handle(handler, [depth]() { return recurse(depth, []() { return 1; }); }));
+	});
+
+	bench::report("capture", name, total - setup, { { "stack_bytes", double(bytes) } });
+}
+
+int main() {
+	for (size_t bytes = 1024; bytes <= 256 * 1024; bytes *= 4) {
+		run("one-shot", one_shot_effect, bytes);
+		run("multi-shot", multi_shot_effect, bytes);
+	}
+	return 0;
+}
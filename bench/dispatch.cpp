@@ -0,0 +1,79 @@
+#include <functional>
+#include "effects/effects.h"
+#include "bench.h"
+
+/**
+ * Measures the cost of performing an effect that is handled by the outermost of a number of
+ * nested handlers. Finding the handler should not depend on the depth. One-shot clauses still
+ * grow with the depth, since the continuation contains all frames between the handler and the
+ * performing frame.
+ */
+
+using namespace effects;
+
+// Effects performed by each handled body. Resuming a one-shot continuation from a clause nests on
+// the stack of the handler, so that count is kept fairly low.
+static const int tail_per_body = 2000;
+static const int one_shot_per_body = 100;
+
+// Number of handled bodies.
+static const int rounds = 2000;
+
+// Effect handled by the intermediate handlers. Never performed.
+Effect<int (int)> filler_effect;
+
+Effect<int (int)> tail_effect;
+Effect<int (int)> one_shot_effect;
+
+Handler<int, int> filler_handler{
+	{ filler_effect, [](int x) { return x; } }
+};
+
+Handler<int, int> outer_handler{
+	{
+		{ tail_effect, [](int x) { return x + 1; } },
+		{ one_shot_effect, [](int x, const One_Shot_Continuation<int, int> &cont) { return cont(x + 1); } }
+	}
+};
+
+// Execute "body" inside "depth" filler handlers.
+static int nest(size_t depth, const std::function<int ()> &body) {
+	if (depth == 0)
+		return body();
+	return handle(filler_handler, [depth, &body]() { return nest(depth - 1, body); });
+}
+
+template <typename Signature>
+static void run(const char *name, Effect<Signature> &effect, int per_body, size_t depth) {
+	double total = bench::measure(rounds * per_body, [&effect, per_body, depth]() {
+		for (int r = 0; r < rounds; r++) {
+			bench::keep(handle(outer_handler, [&effect, per_body, depth]() {
+				return nest(depth, [&effect, per_body]() {
+					int x = 0;
+					for (int i = 0; i < per_body; i++)
+						x = effect(+x);
+					return x;
+				});
+			}));
+		}
+	});
+
+	// Subtract the time spent setting up the handlers.
+	double setup = bench::measure(rounds * per_body, [depth]() {
+		for (int r = 0; r < rounds; r++) {
+			bench::keep(handle(outer_handler, [depth]() {
+				return nest(depth, []() { return 0; });
+			}));
+		}
+	});
+
+	bench::report("dispatch", name, total - setup, { { "depth", double(depth) } });
+}
+
+int main() {
+	for (size_t depth = 0; depth <= 32; depth = depth ? depth * 2 : 1) {
+		run("tail-resumptive", tail_effect, tail_per_body, depth);
+		run("one-shot", one_shot_effect, one_shot_per_body, depth);
+	}
+	return 0;
+}
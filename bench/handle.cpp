@@ -0,0 +1,35 @@
+#include "effects/effects.h"
+#include "bench.h"
+
+/**
+ * Measures the cost of setting up and tearing down a handler with handle(), when the body does
+ * not perform any effects.
+ */
+
+using namespace effects;
+
+static const size_t iterations = 200000;
+
+Effect<int (int)> effect;
+
+Handler<int, int> handler{
+	{ effect, [](int x) { return x; } }
+};
+
+auto static_handler = make_handler<int>(clause(effect, [](int x) { return x; }));
+
+template <typename HandlerType>
+static void run(const char *name, const HandlerType &handler, const Stack_Size &size) {
+	bench::report("handle", name, bench::measure(iterations, [&handler, &size]() {
+		for (size_t i = 0; i < iterations; i++)
+			bench::keep(handle(handler, []() { return 1; }, size));
+	}), { { "stack_size", double(size.bytes()) } });
+}
+
+int main() {
+	run("Handler", handler, Stack_Size());
+	run("make_handler", static_handler, Stack_Size());
+	run("Handler", handler, Stack_Size(16 * 1024));
+	run("make_handler", static_handler, Stack_Size(16 * 1024));
+	return 0;
+}
@@ -0,0 +1,60 @@
+#include "effects/effects.h"
+#include "bench.h"
+
+/**
+ * Measures the round trip of performing an effect and resuming the continuation, for the different
+ * kinds of handler clauses. The cost of handle() itself is subtracted.
+ */
+
+using namespace effects;
+
+// Effects performed by each handled body. Resuming a continuation from a clause nests on the stack
+// of the handler, so this is kept fairly low.
+static const int per_body = 100;
+
+// Number of handled bodies.
+static const int rounds = 10000;
+
+Effect<int (int)> tail_effect;
+Effect<int (int)> one_shot_effect;
+Effect<int (int)> multi_shot_effect;
+
+Handler<int, int> handler{
+	{
+		{ tail_effect, [](int x) { return x + 1; } },
+		{ one_shot_effect, [](int x, const One_Shot_Continuation<int, int> &cont) { return cont(x + 1); } },
+		{ multi_shot_effect, [](int x, const Continuation<int, int> &cont) { return cont(x + 1); } }
+	}
+};
+
+// The same tail-resumptive clause, but without type erasure.
+auto static_handler = make_handler<int>(clause(tail_effect, [](int x) { return x + 1; }));
+
+template <typename Signature, typename HandlerType = Handler<int, int>>
+static void run(const char *name, Effect<Signature> &effect, const HandlerType &handler = ::handler) {
+	double total = bench::measure(rounds * per_body, [&effect, &handler]() {
+		for (int r = 0; r < rounds; r++) {
+			bench::keep(handle(handler, [&effect]() {
+				int x = 0;
+				for (int i = 0; i < per_body; i++)
+					x = effect(+x);
+				return x;
+			}));
+		}
+	});
+
+	double setup = bench::measure(rounds * per_body, [&handler]() {
+		for (int r = 0; r < rounds; r++)
+			bench::keep(handle(handler, []() { return 0; }));
+	});
+
+	bench::report("perform", name, total - setup);
+}
+
+int main() {
+	run("tail-resumptive", tail_effect);
+	run("tail-resumptive (make_handler)", tail_effect, static_handler);
+	run("one-shot", one_shot_effect);
+	run("multi-shot", multi_shot_effect);
+	return 0;
+}
@@ -0,0 +1,48 @@
+#include <memory>
+#include "effects/effects.h"
+#include "bench.h"
+
+/**
+ * Measures the cost of copying a Shared_Ptr inside and outside of handled code, compared to
+ * std::shared_ptr. Shared_Ptrs located on handler stacks are registered in the handler frame.
+ */
+
+using namespace effects;
+
+static const size_t iterations = 5000000;
+
+Effect<int (int)> effect;
+
+Handler<int, int> handler{
+	{ effect, [](int x) { return x; } }
+};
+
+template <typename Ptr>
+static void copy_loop(const Ptr &src) {
+	for (size_t i = 0; i < iterations; i++) {
+		Ptr copy = src;
+		bench::keep(copy);
+	}
+}
+
+int main() {
+	std::shared_ptr<int> std_ptr = std::make_shared<int>(1);
+	Shared_Ptr<int> ptr = mk_shared<int>(1);
+
+	bench::report("shared_ptr", "std::shared_ptr", bench::measure(iterations, [&std_ptr]() {
+		copy_loop(std_ptr);
+	}));
+
+	bench::report("shared_ptr", "Shared_Ptr", bench::measure(iterations, [&ptr]() {
+		copy_loop(ptr);
+	}));
+
+	bench::report("shared_ptr", "Shared_Ptr (handled)", bench::measure(iterations, [&ptr]() {
+		handle(handler, [&ptr]() {
+			copy_loop(ptr);
+			return 0;
+		});
+	}));
+
+	return 0;
+}
@@ -0,0 +1,111 @@
+#include "effects/effects.h"
+#include "bench.h"
+
+/**
+ * Measures the cost of capturing and resuming a multi-shot continuation repeatedly from the same
+ * stack, with copied and with copy-on-write snapshots. Copied snapshots grow with the depth of the
+ * stack, copy-on-write snapshots only with the pages written between effects. Deduplicated
+ * snapshots still copy the whole stack, but store the unchanged pages only once.
+ *
+ * Also measures the cost of resuming a single continuation many times, as in backtracking
+ * search. Each resumption only needs to restore what the previous one modified.
+ */
+
+using namespace effects;
+
+// Effects performed by each handled body.
+static const int per_body = 100;
+
+// Number of handled bodies.
+static const int rounds = 20;
+
+// Approximate stack usage of each level of recursion.
+static const size_t frame_size = 256;
+
+// Number of times each continuation is resumed in the backtracking benchmark.
+static const int resumes = 1000;
+
+Effect<int (int)> effect;
+Effect<int (int)> choose;
+
+Handler<int, int> handler{
+	{
+		{ effect, [](int x, const Continuation<int, int> &cont) { return cont(x + 1); } },
+		{ choose, [](int x, const Continuation<int, int> &cont) {
+				int total = 0;
+				for (int i = 0; i < resumes; i++)
+					total += cont(x + i);
+				return total;
+			} }
+	}
+};
+
+// Recurse "depth" times, then call "fn".
+template <typename Function>
+__attribute__((noinline)) int recurse(size_t depth, const Function &fn) {
+	volatile char pad[frame_size - 32];
+	pad[0] = 1;
+	if (depth == 0)
+		return fn();
+	return recurse(depth - 1, fn) + pad[0];
+}
+
+static void run(const char *name, bool copy_on_write, bool deduplicate, size_t bytes) {
+	Snapshot_Config config;
+	config.copy_on_write = copy_on_write;
+	config.deduplicate = deduplicate;
+	snapshot_config(config);
+
+	size_t depth = bytes / frame_size;
+	Stack_Size stack_size(bytes + 256 * 1024);
+
+	double total = bench::measure(rounds * per_body, [depth, &stack_size]() {
+		for (int r = 0; r < rounds; r++) {
+			bench::keep(handle(handler, [depth]() {
+				return recurse(depth, []() {
+					int x = 0;
+					for (int i = 0; i < per_body; i++)
+						x = effect(+x);
+					return x;
+				});
+			}, stack_size));
+		}
+	});
+
+	double setup = bench::measure(rounds * per_body, [depth, &stack_size]() {
+		for (int r = 0; r < rounds; r++)
+			bench::keep(handle(handler, [depth]() { return recurse(depth, []() { return 0; }); }, stack_size));
+	});
+
+	bench::report("snapshot", name, total - setup, { { "stack_bytes", double(bytes) } });
+}
+
+static void run_resumes(const char *name, bool copy_on_write, size_t bytes) {
+	Snapshot_Config config;
+	config.copy_on_write = copy_on_write;
+	snapshot_config(config);
+
+	size_t depth = bytes / frame_size;
+	Stack_Size stack_size(bytes + 256 * 1024);
+
+	double total = bench::measure(resumes, [depth, &stack_size]() {
+		bench::keep(handle(handler, [depth]() {
+			return recurse(depth, []() { return choose(1); });
+		}, stack_size));
+	});
+
+	bench::report("snapshot", name, total, { { "stack_bytes", double(bytes) } });
+}
+
+int main() {
+	for (size_t bytes = 4 * 1024; bytes <= 1024 * 1024; bytes *= 4) {
+		run("copy", false, false, bytes);
+		run("copy deduplicated", false, true, bytes);
+		run("copy-on-write", true, false, bytes);
+	}
+	for (size_t bytes = 4 * 1024; bytes <= 1024 * 1024; bytes *= 4) {
+		run_resumes("resume copy", false, bytes);
+		run_resumes("resume copy-on-write", true, bytes);
+	}
+	return 0;
+}
@@ -0,0 +1,52 @@
+#include <ucontext.h>
+#include "effects/context.h"
+#include "bench.h"
+
+/**
+ * Measures the cost of a single switch between two stacks, using swapcontext directly (which is
+ * what the library used previously) and using effects::Context.
+ */
+
+using namespace effects;
+
+// Number of round-trips to measure.
+static const size_t iterations = 2000000;
+
+// Stack for the other context.
+alignas(16) static char other_stack[64 * 1024];
+
+static ucontext_t uc_main, uc_other;
+
+static void uc_loop() {
+	while (true)
+		swapcontext(&uc_other, &uc_main);
+}
+
+static Context ctx_main, ctx_other;
+
+static void ctx_loop(void *) {
+	while (true)
+		Context::swap(ctx_other, ctx_main);
+}
+
+int main() {
+	getcontext(&uc_other);
+	uc_other.uc_stack.ss_sp = other_stack;
+	uc_other.uc_stack.ss_size = sizeof(other_stack);
+	uc_other.uc_link = nullptr;
+	makecontext(&uc_other, &uc_loop, 0);
+
+	bench::report("switch", "swapcontext", bench::measure(2 * iterations, []() {
+		for (size_t i = 0; i < iterations; i++)
+			swapcontext(&uc_main, &uc_other);
+	}));
+
+	ctx_other.prepare(other_stack, sizeof(other_stack), &ctx_main, &ctx_loop, nullptr);
+
+	bench::report("switch", "effects::Context", bench::measure(2 * iterations, []() {
+		for (size_t i = 0; i < iterations; i++)
+			Context::swap(ctx_main, ctx_other);
+	}));
+
+	return 0;
+}
@@ -0,0 +1,148 @@
+#include "allocator.h"
+#include "config.h"
+#include <atomic>
+
+namespace effects {
+
+	static std::atomic<void *(*)(size_t, void *)> config_allocate = nullptr;
+	static std::atomic<void (*)(void *, size_t, void *)> config_deallocate = nullptr;
+	static std::atomic<void *> config_context = nullptr;
+	static std::atomic<size_t> config_max_cached = Allocator_Config().max_cached;
+
+	Allocator_Config allocator_config() {
+		Allocator_Config result;
+		result.allocate = config_allocate.load(std::memory_order_relaxed);
+		result.deallocate = config_deallocate.load(std::memory_order_relaxed);
+		result.context = config_context.load(std::memory_order_relaxed);
+		result.max_cached = config_max_cached.load(std::memory_order_relaxed);
+		return result;
+	}
+
+	void allocator_config(const Allocator_Config &config) {
+		config_allocate.store(config.allocate, std::memory_order_relaxed);
+		config_deallocate.store(config.deallocate, std::memory_order_relaxed);
+		config_context.store(config.context, std::memory_order_relaxed);
+		config_max_cached.store(config.max_cached, std::memory_order_relaxed);
+	}
+
+	// Allocate through the hooks.
+	static void *hook_allocate(size_t size) {
+		if (auto fn = config_allocate.load(std::memory_order_relaxed))
+			return fn(size, config_context.load(std::memory_order_relaxed));
+		return ::operator new(size);
+	}
+
+	// Free through the hooks.
+	static void hook_deallocate(void *memory, size_t size) {
+		if (auto fn = config_deallocate.load(std::memory_order_relaxed))
+			fn(memory, size, config_context.load(std::memory_order_relaxed));
+		else
+			::operator delete(memory);
+	}
+
+	// Smallest block size.
+	static const size_t min_block = 16;
+
+	// Number of block sizes, from "min_block" to "max_cached_block".
+	static const size_t block_classes = 13;
+	static_assert(min_block << (block_classes - 1) == max_cached_block, "Inconsistent block sizes.");
+
+	// Index of the block size to use for "size" bytes. "block_classes" if the size is not cached.
+	static inline size_t block_class(size_t size) {
+		if (size <= min_block)
+			return 0;
+		if (size > max_cached_block)
+			return block_classes;
+		return size_t(64 - __builtin_clzll(size - 1)) - 4;
+	}
+
+	// Size of blocks of a class.
+	static inline size_t block_size(size_t c) {
+		return min_block << c;
+	}
+
+	/**
+	 * Cached blocks of a thread. Trivial to construct and destroy, so that it can be accessed
+	 * cheaply. Released by a Block_Cache_Release object when the thread exits.
+	 */
+	struct Block_Cache {
+		// Free blocks of each class, linked through their first word.
+		void *free[block_classes];
+
+		// Bytes in the cache.
+		size_t bytes;
+
+		// Has the release been registered?
+		bool registered;
+
+		// Has the cache been released at thread exit? Blocks are then no longer cached.
+		bool closed;
+	};
+
+	static EFFECTS_FAST_THREAD_LOCAL Block_Cache block_cache;
+
+	/**
+	 * Releases the cache of a thread when the thread exits.
+	 */
+	struct Block_Cache_Release {
+		~Block_Cache_Release() {
+			release_cached_blocks();
+			block_cache.closed = true;
+		}
+	};
+
+	void *allocate(size_t size) {
+		size_t c = block_class(size);
+		if (c == block_classes)
+			return hook_allocate(size);
+
+		Block_Cache &cache = block_cache;
+		if (void *block = cache.free[c]) {
+			cache.free[c] = *static_cast<void **>(block);
+			cache.bytes -= block_size(c);
+			return block;
+		}
+
+		// Allocate the whole block, so that it can be reused for any size of its class.
+		return hook_allocate(block_size(c));
+	}
+
+	void deallocate(void *memory, size_t size) {
+		if (!memory)
+			return;
+
+		size_t c = block_class(size);
+		if (c == block_classes) {
+			hook_deallocate(memory, size);
+			return;
+		}
+
+		Block_Cache &cache = block_cache;
+		if (cache.closed || cache.bytes + block_size(c) > config_max_cached.load(std::memory_order_relaxed)) {
+			hook_deallocate(memory, block_size(c));
+			return;
+		}
+
+		if (!cache.registered) {
+			cache.registered = true;
+			static EFFECTS_THREAD_LOCAL Block_Cache_Release release;
+			(void)release;
+		}
+
+		*static_cast<void **>(memory) = cache.free[c];
+		cache.free[c] = memory;
+		cache.bytes += block_size(c);
+	}
+
+	void release_cached_blocks() {
+		Block_Cache &cache = block_cache;
+		for (size_t c = 0; c < block_classes; c++) {
+			while (void *block = cache.free[c]) {
+				cache.free[c] = *static_cast<void **>(block);
+				hook_deallocate(block, block_size(c));
+			}
+		}
+		cache.bytes = 0;
+	}
+
+}
@@ -0,0 +1,155 @@
+#pragma once
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <utility>
+
+namespace effects {
+
+	/**
+	 * Allocation of the memory that the library uses internally while handling effects: handler
+	 * frames, handled bodies, captured continuations and the buffers of stack snapshots. Stacks are
+	 * managed by Stack_Pool.
+	 *
+	 * Freed blocks of up to "max_cached_block" bytes are kept in a cache for each thread, by size
+	 * rounded up to a power of two, and reused by later allocations. Performing an effect and
+	 * resuming its continuation allocates and frees the same sizes each time, so a loop that
+	 * performs effects does not allocate any memory from the system after its first iteration.
+	 * Blocks freed by another thread than the one that allocated them end up in the cache of the
+	 * freeing thread. The cache of a thread is released when the thread exits.
+	 *
+	 * Blocks that are not taken from or kept in a cache are allocated and freed through the
+	 * hooks, which default to operator new and delete. The hooks must be set before the library
+	 * allocates any memory, since blocks are freed through the hooks that are set at that time.
+	 */
+	struct Allocator_Config {
+		// Allocate "size" bytes, aligned for any type. Throws std::bad_alloc on failure. If null,
+		// operator new is used.
+		void *(*allocate)(size_t size, void *context) = nullptr;
+
+		// Free memory from "allocate". If null, operator delete is used.
+		void (*deallocate)(void *memory, size_t size, void *context) = nullptr;
+
+		// Passed to "allocate" and "deallocate".
+		void *context = nullptr;
+
+		// Maximum number of bytes kept in the cache of each thread. Zero disables the caches.
+		size_t max_cached = 1024 * 1024;
+	};
+
+	// Get/set the configuration.
+	Allocator_Config allocator_config();
+	void allocator_config(const Allocator_Config &config);
+
+	// Largest block that is cached.
+	const size_t max_cached_block = 64 * 1024;
+
+	// Allocate memory for internal use.
+	void *allocate(size_t size);
+
+	// Free memory from "allocate". "size" must be the size that was allocated.
+	void deallocate(void *memory, size_t size);
+
+	// Free the blocks in the cache of the current thread.
+	void release_cached_blocks();
+
+
+	/**
+	 * Allocator for standard containers that uses "allocate" and "deallocate".
+	 */
+	template <typename T>
+	class Allocator {
+	public:
+		static_assert(alignof(T) <= alignof(std::max_align_t), "Over-aligned types are not supported.");
+
+		typedef T value_type;
+
+		Allocator() = default;
+
+		template <typename U>
+		Allocator(const Allocator<U> &) {}
+
+		T *allocate(size_t n) {
+			return static_cast<T *>(effects::allocate(n * sizeof(T)));
+		}
+
+		void deallocate(T *p, size_t n) {
+			effects::deallocate(p, n * sizeof(T));
+		}
+
+		template <typename U>
+		bool operator ==(const Allocator<U> &) const {
+			return true;
+		}
+
+		template <typename U>
+		bool operator !=(const Allocator<U> &) const {
+			return false;
+		}
+	};
+
+
+
+	/**
+	 * Bytes allocated with "allocate". Containers with a custom allocator copy elements one at a
+	 * time, which is slow for large amounts of bytes, so this class copies them with memcpy.
+	 */
+	class Byte_Buffer {
+	public:
+		// Create an empty buffer.
+		Byte_Buffer() = default;
+
+		// Create a buffer of "size" uninitialized bytes.
+		explicit Byte_Buffer(size_t size)
+			: begin(size > 0 ? static_cast<char *>(allocate(size)) : nullptr), count(size) {}
+
+		// Create a copy of the bytes [from, to).
+		Byte_Buffer(const char *from, const char *to) {
+			assign(from, to);
+		}
+
+		Byte_Buffer(const Byte_Buffer &o) {
+			assign(o.begin, o.begin + o.count);
+		}
+
+		Byte_Buffer(Byte_Buffer &&o) : begin(o.begin), count(o.count) {
+			o.begin = nullptr;
+			o.count = 0;
+		}
+
+		Byte_Buffer &operator =(Byte_Buffer o) {
+			std::swap(begin, o.begin);
+			std::swap(count, o.count);
+			return *this;
+		}
+
+		~Byte_Buffer() {
+			deallocate(begin, count);
+		}
+
+		// Replace the contents with a copy of [from, to).
+		void assign(const char *from, const char *to) {
+			deallocate(begin, count);
+			begin = nullptr;
+			count = to - from;
+			if (count > 0) {
+				begin = static_cast<char *>(allocate(count));
+				std::memcpy(begin, from, count);
+			}
+		}
+
+		char *data() const {
+			return begin;
+		}
+
+		size_t size() const {
+			return count;
+		}
+
+	private:
+		// The bytes.
+		char *begin = nullptr;
+		size_t count = 0;
+	};
+
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include <tuple>
+#include <cassert>
 #include <optional>
 #include "handle_body.h"
 #include "handler_clause.h"
@@ -35,6 +36,9 @@ namespace effects {
 
 		// Call the captured effect.
 		virtual void call(Resume_Params params) = 0;
+
+		// Call a tail-resumptive clause for the captured effect, on the current stack.
+		virtual void call_tail(const Handler_Clause &clause) = 0;
 	};
 
 
@@ -54,12 +58,24 @@ namespace effects {
 		virtual void call(Resume_Params params) override {
 			using Handler_Type = Partial_Handler_Clause<Result (Args...)>;
 
-			// Note: We can use static_cast, but we use dynamic_cast to get a "free" assert of the types.
-			const Handler_Type &handler = dynamic_cast<const Handler_Type &>(*params.to_call);
+			// The clause was found using the ID of the effect, so it has the same signature.
+			assert(params.to_call->signature == &type_tag<Result (Args...)>);
+			assert(!params.to_call->tail_resumptive);
+			const Handler_Type &handler = checked_cast<const Handler_Type &>(*params.to_call);
 
 			handler.call(params.result_to->generic_result(), args, *params.continuation, result);
 		}
 
+		// Call a tail-resumptive clause.
+		virtual void call_tail(const Handler_Clause &clause) override {
+			using Handler_Type = Partial_Tail_Handler_Clause<Result (Args...)>;
+
+			assert(clause.signature == &type_tag<Result (Args...)>);
+			assert(clause.tail_resumptive);
+			const Handler_Type &handler = checked_cast<const Handler_Type &>(clause);
+			handler.call(args, result);
+		}
+
 	private:
 		// Parameters.
 		std::tuple<Args...> args;
@@ -0,0 +1,27 @@
+#pragma once
+
+/**
+ * Compile-time configuration.
+ *
+ * Define EFFECTS_SINGLE_THREADED if only a single thread in the program uses the library. Reference
+ * counts of Shared_Ptrs are then not atomic, and the state that is otherwise kept per thread is
+ * stored in global variables. The macro must be defined consistently for the library and for code
+ * that uses it.
+ */
+
+#ifdef EFFECTS_SINGLE_THREADED
+#define EFFECTS_THREAD_LOCAL
+#define EFFECTS_FAST_THREAD_LOCAL
+#else
+#define EFFECTS_THREAD_LOCAL thread_local
+
+// Thread-local storage for variables that are trivial to construct and destroy. Accessing
+// thread_local variables in other translation units involves a call to check if they need to be
+// initialized, which __thread avoids.
+#if defined(__GNUC__)
+#define EFFECTS_FAST_THREAD_LOCAL __thread
+#else
+#define EFFECTS_FAST_THREAD_LOCAL thread_local
+#endif
+
+#endif
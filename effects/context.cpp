@@ -0,0 +1,328 @@
+#include "context.h"
+#include <cstdint>
+#include <type_traits>
+
+#ifdef EFFECTS_ASM_CONTEXT
+
+// Name of a C symbol in assembly.
+#if defined(__APPLE__)
+#define EFFECTS_ASM_NAME(x) "_" #x
+#else
+#define EFFECTS_ASM_NAME(x) #x
+#endif
+
+// Declare a function in assembly.
+#if defined(__ELF__)
+#define EFFECTS_ASM_FUNCTION(x) \
+	".globl " EFFECTS_ASM_NAME(x) "\n" \
+	".type " EFFECTS_ASM_NAME(x) ", %function\n" \
+	EFFECTS_ASM_NAME(x) ":\n"
+#define EFFECTS_ASM_END(x) \
+	".size " EFFECTS_ASM_NAME(x) ", .-" EFFECTS_ASM_NAME(x) "\n"
+#else
+#define EFFECTS_ASM_FUNCTION(x) \
+	".globl " EFFECTS_ASM_NAME(x) "\n" \
+	EFFECTS_ASM_NAME(x) ":\n"
+#define EFFECTS_ASM_END(x)
+#endif
+
+extern "C" {
+	// Save the current state to "*save", and resume the state at "load".
+	void effects_switch_context(void **save, void *load);
+
+	// Entry point of new contexts. Expects the context in a callee-saved register.
+	void effects_context_entry();
+
+	// Called by "effects_context_entry".
+	[[noreturn]] void effects_context_main(effects::Context *context);
+}
+
+#if defined(__x86_64__)
+
+/**
+ * Layout of the state pushed on the stack (offsets from the saved stack pointer):
+ * 0: mxcsr (4 bytes), x87 control word (2 bytes)
+ * 8: r15, r14, r13, r12, rbx, rbp
+ * 56: return address
+ */
+__asm__(
+	".text\n"
+	".p2align 4\n"
+	EFFECTS_ASM_FUNCTION(effects_switch_context)
+	"pushq %rbp\n"
+	"pushq %rbx\n"
+	"pushq %r12\n"
+	"pushq %r13\n"
+	"pushq %r14\n"
+	"pushq %r15\n"
+	"subq $8, %rsp\n"
+	"stmxcsr (%rsp)\n"
+	"fnstcw 4(%rsp)\n"
+	"movq %rsp, (%rdi)\n"
+	"movq %rsi, %rsp\n"
+	"ldmxcsr (%rsp)\n"
+	"fldcw 4(%rsp)\n"
+	"addq $8, %rsp\n"
+	"popq %r15\n"
+	"popq %r14\n"
+	"popq %r13\n"
+	"popq %r12\n"
+	"popq %rbx\n"
+	"popq %rbp\n"
+	"ret\n"
+	EFFECTS_ASM_END(effects_switch_context)
+
+	".p2align 4\n"
+	EFFECTS_ASM_FUNCTION(effects_context_entry)
+	".cfi_startproc\n"
+	// CFA = *(rbp + 16), return address at rbp + 8, rbp at rbp + 0.
+	".cfi_escape 0x0f, 0x03, 0x76, 0x10, 0x06\n"
+	".cfi_escape 0x10, 0x10, 0x02, 0x76, 0x08\n"
+	".cfi_escape 0x10, 0x06, 0x02, 0x76, 0x00\n"
+	"subq $8, %rsp\n"
+	"movq %r12, %rdi\n"
+	"call " EFFECTS_ASM_NAME(effects_context_main) "\n"
+	"ud2\n"
+	".cfi_endproc\n"
+	EFFECTS_ASM_END(effects_context_entry)
+	);
+
+// Number of words in the saved state.
+static const size_t saved_words = 9;
+
+// Position of the saved registers we need to initialize.
+static const size_t saved_context = 4; // r12
+static const size_t saved_frame = 6; // rbp
+static const size_t saved_return = 7;
+
+// Store the current floating-point control registers in the state.
+static void save_fp_control(void **state) {
+	uint32_t mxcsr;
+	uint16_t fcw;
+	__asm__ volatile ("stmxcsr %0" : "=m" (mxcsr));
+	__asm__ volatile ("fnstcw %0" : "=m" (fcw));
+	state[0] = reinterpret_cast<void *>(size_t(mxcsr) | (size_t(fcw) << 32));
+}
+
+#elif defined(__aarch64__)
+
+/**
+ * Layout of the state pushed on the stack (offsets from the saved stack pointer):
+ * 0: x19-x28
+ * 80: x29 (frame pointer), x30 (return address)
+ * 96: d8-d15
+ * 160: fpcr
+ * 168: padding
+ */
+__asm__(
+	".text\n"
+	".p2align 2\n"
+	EFFECTS_ASM_FUNCTION(effects_switch_context)
+	"sub sp, sp, #176\n"
+	"stp x19, x20, [sp, #0]\n"
+	"stp x21, x22, [sp, #16]\n"
+	"stp x23, x24, [sp, #32]\n"
+	"stp x25, x26, [sp, #48]\n"
+	"stp x27, x28, [sp, #64]\n"
+	"stp x29, x30, [sp, #80]\n"
+	"stp d8, d9, [sp, #96]\n"
+	"stp d10, d11, [sp, #112]\n"
+	"stp d12, d13, [sp, #128]\n"
+	"stp d14, d15, [sp, #144]\n"
+	"mrs x9, fpcr\n"
+	"str x9, [sp, #160]\n"
+	"mov x9, sp\n"
+	"str x9, [x0]\n"
+	"mov sp, x1\n"
+	"ldp x19, x20, [sp, #0]\n"
+	"ldp x21, x22, [sp, #16]\n"
+	"ldp x23, x24, [sp, #32]\n"
+	"ldp x25, x26, [sp, #48]\n"
+	"ldp x27, x28, [sp, #64]\n"
+	"ldp x29, x30, [sp, #80]\n"
+	"ldp d8, d9, [sp, #96]\n"
+	"ldp d10, d11, [sp, #112]\n"
+	"ldp d12, d13, [sp, #128]\n"
+	"ldp d14, d15, [sp, #144]\n"
+	"ldr x9, [sp, #160]\n"
+	"msr fpcr, x9\n"
+	"add sp, sp, #176\n"
+	"ret\n"
+	EFFECTS_ASM_END(effects_switch_context)
+
+	".p2align 2\n"
+	EFFECTS_ASM_FUNCTION(effects_context_entry)
+	".cfi_startproc\n"
+	// CFA = *(x29 + 16), return address at x29 + 8, x29 at x29 + 0.
+	".cfi_escape 0x0f, 0x03, 0x8d, 0x10, 0x06\n"
+	".cfi_escape 0x10, 0x1e, 0x02, 0x8d, 0x08\n"
+	".cfi_escape 0x10, 0x1d, 0x02, 0x8d, 0x00\n"
+	"mov x0, x19\n"
+	"bl " EFFECTS_ASM_NAME(effects_context_main) "\n"
+	"brk #0\n"
+	".cfi_endproc\n"
+	EFFECTS_ASM_END(effects_context_entry)
+	);
+
+// Number of words in the saved state.
+static const size_t saved_words = 22;
+
+// Position of the saved registers we need to initialize.
+static const size_t saved_context = 0; // x19
+static const size_t saved_frame = 10; // x29
+static const size_t saved_return = 11; // x30
+
+// Store the current floating-point control registers in the state.
+static void save_fp_control(void **state) {
+	uint64_t fpcr;
+	__asm__ volatile ("mrs %0, fpcr" : "=r" (fpcr));
+	state[20] = reinterpret_cast<void *>(fpcr);
+}
+
+#endif
+
+namespace effects {
+
+	struct Context_Entry {
+		// Note: noexcept so that exceptions are never propagated past the start of the stack,
+		// even though the unwind information refers to the link context.
+		static void main(Context *context) noexcept {
+			context->fn(context->arg);
+
+			// Note: The link is inspected when "fn" returns, not when the context was prepared.
+			Context *link = context->link;
+			effects_switch_context(&context->sp, link->sp);
+		}
+	};
+
+	Context::Context() : sp(nullptr), frame{nullptr, nullptr, nullptr}, link(nullptr), fn(nullptr), arg(nullptr) {}
+
+	void Context::prepare(void *base, size_t size, Context *link, void (*fn)(void *), void *arg) {
+		this->link = link;
+		this->fn = fn;
+		this->arg = arg;
+
+		size_t top = reinterpret_cast<size_t>(base) + size;
+		top &= ~size_t(15);
+
+		// Keep the alignment expected at the start of a function.
+		void **state = reinterpret_cast<void **>(top) - 2 - saved_words;
+		for (size_t i = 0; i < saved_words + 2; i++)
+			state[i] = nullptr;
+
+		save_fp_control(state);
+		state[saved_context] = this;
+		state[saved_return] = reinterpret_cast<void *>(&effects_context_entry);
+
+		// The entry point uses the frame of "link" as its caller. It is updated whenever "link"
+		// is suspended, which is always the case when we are executing.
+		state[saved_frame] = link->frame;
+
+		sp = state;
+	}
+
+	// Note: Must not be inlined, since we record the frame of our caller.
+	__attribute__((noinline)) void Context::swap(Context &from, Context &to) {
+		from.frame[0] = *reinterpret_cast<void **>(__builtin_frame_address(0));
+		from.frame[1] = __builtin_return_address(0);
+		from.frame[2] = __builtin_dwarf_cfa();
+		effects_switch_context(&from.sp, to.sp);
+	}
+
+	size_t Context::stack_pointer() const {
+		return reinterpret_cast<size_t>(sp);
+	}
+
+}
+
+void effects_context_main(effects::Context *context) {
+	effects::Context_Entry::main(context);
+	__builtin_unreachable();
+}
+
+#else
+
+namespace effects {
+
+	Context::Context() {
+		getcontext(&context);
+	}
+
+	void Context::prepare(void *base, size_t size, Context *link, void (*fn)(void *), void *arg) {
+		context.uc_stack.ss_sp = base;
+		context.uc_stack.ss_size = size;
+		context.uc_link = &link->context;
+		makecontext(&context, reinterpret_cast<void (*)()>(fn), 1, arg);
+	}
+
+	void Context::swap(Context &from, Context &to) {
+		swapcontext(&from.context, &to.context);
+	}
+
+	size_t Context::stack_pointer() const {
+#if defined(__linux__)
+
+#if defined(__x86_64__)
+		return context.uc_mcontext.gregs[REG_RSP];
+#elif defined(__aarch64__)
+		return context.uc_mcontext.sp;
+#else
+#error "Unknown machine, can not extract the stack pointer."
+		return 0;
+#endif
+
+#elif defined(__APPLE__)
+
+		// Note: The mcontext is a pointer, we probably need to store that as well!
+#if defined(__x86_64)
+#if __DARWIN_UNIX03
+		return context.uc_mcontext->__ss.__rsp;
+#else
+		return context.uc_mcontext->ss.rsp;
+#endif
+#elif defined(__aarch64__)
+#if __DARWIN_UNIX03
+		return context.uc_mcontext->__ss.__sp;
+#else
+		return context.uc_mcontext->ss.sp;
+#endif
+#else
+#error "Unknown machine, can not extract the stack pointer."
+		return 0;
+#endif
+
+#else
+#error "Unknown platform."
+#endif
+	}
+
+	template <typename T>
+	struct Save_MContext {
+		static void save(T &context, Byte_Buffer &store) {
+			// Only need to do something if the member is a pointer!
+			(void)context;
+			(void)store;
+		}
+	};
+
+	template <typename T>
+	struct Save_MContext<T *> {
+		// Only need to do something if the member is a pointer!
+		static void save(T *&context, Byte_Buffer &store) {
+			const char *begin = reinterpret_cast<const char *>(context);
+			const char *end = begin + sizeof(T);
+			store.assign(begin, end);
+
+			// Store the updated pointer back!
+			context = reinterpret_cast<T *>(store.data());
+		}
+	};
+
+	void Context::save_state(Byte_Buffer &store) {
+		using Type = std::remove_cv_t<std::remove_reference_t<decltype(context.uc_mcontext)>>;
+		Save_MContext<Type>::save(context.uc_mcontext, store);
+	}
+
+}
+
+#endif
@@ -0,0 +1,83 @@
+#pragma once
+#include <cstddef>
+#include "allocator.h"
+
+/**
+ * Switching between execution stacks.
+ *
+ * On x86_64 and aarch64, switching is implemented in assembly. The callee-saved registers and the
+ * floating-point control registers are pushed onto the stack being suspended, so the only state
+ * that needs to be stored outside of the stack itself is the stack pointer. In particular, the
+ * signal mask is not saved or restored, which saves two system calls per switch.
+ *
+ * Other platforms use ucontext. Define EFFECTS_UCONTEXT to use ucontext everywhere.
+ *
+ * With the assembly implementation, the bottom of a new stack is linked to the place where its
+ * link context was last suspended, both with a frame pointer and with CFI. Thus, backtraces from
+ * debuggers, profilers and "backtrace" continue into the code that called handle() rather than
+ * stopping at the start of the stack. Stack traces through ucontext stacks stop at the start of
+ * the stack.
+ */
+
+#if !defined(EFFECTS_UCONTEXT) && (defined(__x86_64__) || defined(__aarch64__))
+#define EFFECTS_ASM_CONTEXT
+#else
+#include <ucontext.h>
+#endif
+
+namespace effects {
+
+	/**
+	 * The execution state of a stack that is not currently executing.
+	 */
+	class Context {
+	public:
+		// Create. The context is suitable as a target for "swap", but can not be resumed until it
+		// has been saved or prepared.
+		Context();
+
+		// Prepare the context for executing "fn(arg)" on the stack in the range [base, base +
+		// size). When "fn" returns, execution continues in "link".
+		void prepare(void *base, size_t size, Context *link, void (*fn)(void *), void *arg);
+
+		// Save the current execution state in "from" and resume "to".
+		static void swap(Context &from, Context &to);
+
+		// Get the stack pointer of the saved state.
+		size_t stack_pointer() const;
+
+#ifndef EFFECTS_ASM_CONTEXT
+		// Make the context self-contained by copying parts of the state that are stored outside of
+		// the context on some platforms into "store".
+		void save_state(Byte_Buffer &store);
+#endif
+
+	private:
+#ifdef EFFECTS_ASM_CONTEXT
+		// Saved stack pointer. Register state is located at the top of the stack.
+		void *sp;
+
+		/**
+		 * Frame record describing the caller of "swap" when this context was last suspended:
+		 * the frame pointer, the return address and the canonical frame address (the stack pointer
+		 * before the call). Contexts that use this context as their link use this as the frame of
+		 * the caller of their entry point.
+		 */
+		void *frame[3];
+
+		// Context to resume when "fn" returns.
+		Context *link;
+
+		// Function to execute, and its parameter.
+		void (*fn)(void *);
+		void *arg;
+
+		// Access from the entry point for new contexts.
+		friend struct Context_Entry;
+#else
+		// The ucontext.
+		ucontext_t context;
+#endif
+	};
+
+}
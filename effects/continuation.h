@@ -1,8 +1,10 @@
 #pragma once
 #include "stack.h"
 #include "result.h"
+#include "profile.h"
 #include "debug.h"
 #include <vector>
+#include <exception>
 
 namespace effects {
 
@@ -14,15 +16,80 @@ namespace effects {
 	class Captured_Continuation {
 	public:
 		// Create a copy of a stack.
-		Captured_Continuation(size_t depth) {
-			frames.reserve(depth);
+		Captured_Continuation(size_t depth, bool one_shot) : one_shot(one_shot) {
+			if (one_shot)
+				handlers.reserve(depth);
+			else
+				frames.reserve(depth);
 		}
 
-		// Store stack frames.
-		std::vector<Stack_Mirror> frames;
+		// Is this a one-shot continuation? One-shot continuations do not copy the stacks, but
+		// refer to the suspended handler frames directly.
+		bool one_shot;
+
+		// Store stack frames. Used for multi-shot continuations.
+		std::vector<Stack_Mirror, Allocator<Stack_Mirror>> frames;
+
+		// Suspended handler frames. Used for one-shot continuations.
+		std::vector<Shared_Ptr<Handler_Frame>, Allocator<Shared_Ptr<Handler_Frame>>> handlers;
+
+		// Has a one-shot continuation been resumed?
+		mutable bool resumed = false;
 
 		// Resume a captured continuation.
 		void resume() const;
+
+		// Attribute resumptions to "effect", and exclude them from "clause".
+		void profile(size_t effect, Profile_Scope &clause) {
+#ifdef EFFECTS_PROFILE
+			profile_effect = effect;
+			profile_clause = &clause;
+#else
+			(void)effect;
+			(void)clause;
+#endif
+		}
+
+#ifdef EFFECTS_PROFILE
+		// Effect that captured the continuation.
+		size_t profile_effect = 0;
+
+		// Measurement of the clause that received the continuation.
+		Profile_Scope *profile_clause = nullptr;
+#endif
+	};
+
+	/**
+	 * Measures the time spent resuming a continuation, and excludes it from the time of the clause
+	 * that resumed it.
+	 */
+	class Resume_Profile {
+	public:
+#ifdef EFFECTS_PROFILE
+		Resume_Profile(const Captured_Continuation &src) : src(src), start(profile_now()) {}
+
+		~Resume_Profile() {
+			uint64_t time = profile_now() - start;
+			profile_record(src.profile_effect, profile_resume, time);
+			if (src.profile_clause)
+				src.profile_clause->exclude(time);
+		}
+
+	private:
+		const Captured_Continuation &src;
+		uint64_t start;
+#else
+		Resume_Profile(const Captured_Continuation &) {}
+#endif
+	};
+
+	// Thrown if a one-shot continuation is resumed more than once.
+	class continuation_resumed : public std::exception {
+	public:
+		continuation_resumed() = default;
+		virtual const char *what() const noexcept {
+			return "A one-shot continuation was resumed more than once.";
+		}
 	};
 
 	/**
@@ -39,11 +106,14 @@ namespace effects {
 		Continuation &operator =(const Continuation &) = delete;
 
 		// Create a continuation from a captured continuation, as well as where to retrieve the result from.
-		Continuation(Captured_Continuation src, effects::Result<Result> &result, effects::Result<Param> &param)
+		// The captured continuation is not copied, so it must outlive the continuation.
+		Continuation(const Captured_Continuation &src, effects::Result<Result> &result, effects::Result<Param> &param)
 			: src(src), result(result), param(param) {}
 
 		// Call the continuation.
 		Result operator() (Param param) const {
+			Resume_Profile profile(src);
+
 			// Restore all stacks first. The parameter is stored on the stack of the receiving
 			// piece, so if we store it before restoring stacks, the value will be overwritten.
 			for (const Stack_Mirror &s : src.frames)
@@ -56,12 +126,54 @@ namespace effects {
 			src.resume();
 
 			// When we are back here, the continuation has finished executing.
-			return this->result.result();
+			return this->result.take();
+		}
+
+	private:
+		// Captured stack frames. Owned by the handler frame that captured them.
+		const Captured_Continuation &src;
+
+		// Where is the result from executing the continuation stored?
+		effects::Result<Result> &result;
+
+		// Where should we store the parameter?
+		effects::Result<Param> &param;
+	};
+
+	/**
+	 * A continuation that can be invoked at most once.
+	 *
+	 * Resuming a one-shot continuation simply switches back to the suspended stacks, without
+	 * copying them when the continuation is captured or restoring them when it is resumed.
+	 */
+	template <typename Result, typename Param>
+	class One_Shot_Continuation {
+	public:
+		// Disable copying the continuation to make resource management easier.
+		One_Shot_Continuation(const One_Shot_Continuation &) = delete;
+		One_Shot_Continuation &operator =(const One_Shot_Continuation &) = delete;
+
+		// Create a continuation from a captured continuation, as well as where to retrieve the result from.
+		One_Shot_Continuation(const Captured_Continuation &src, effects::Result<Result> &result, effects::Result<Param> &param)
+			: src(src), result(result), param(param) {}
+
+		// Call the continuation. Throws "continuation_resumed" if called more than once.
+		Result operator() (Param param) const {
+			if (src.resumed)
+				throw continuation_resumed();
+			src.resumed = true;
+
+			Resume_Profile profile(src);
+			this->param.set(std::move(param));
+			src.resume();
+
+			// When we are back here, the continuation has finished executing.
+			return this->result.take();
 		}
 
 	private:
-		// Captured stack frames.
-		Captured_Continuation src;
+		// Captured handler frames.
+		const Captured_Continuation &src;
 
 		// Where is the result from executing the continuation stored?
 		effects::Result<Result> &result;
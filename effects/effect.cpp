@@ -1,9 +1,50 @@
 #include "effect.h"
 #include "handler_frame.h"
 #include "debug.h"
+#include <mutex>
+#include <unordered_map>
 
 namespace effects {
 
+	/**
+	 * Names of named effects. Effects may be created and destroyed on any thread.
+	 */
+	struct Effect_Names {
+		std::mutex lock;
+		std::unordered_map<size_t, const char *> names;
+	};
+
+	// Note: Inside a function so that effects may be created by static initializers.
+	static Effect_Names &effect_names() {
+		static Effect_Names names;
+		return names;
+	}
+
+	Effect_Base::Effect_Base(const char *name) : effect_name(name) {
+		if (name) {
+			Effect_Names &names = effect_names();
+			std::lock_guard<std::mutex> guard(names.lock);
+			names.names[id()] = name;
+		}
+	}
+
+	Effect_Base::~Effect_Base() {
+		if (effect_name) {
+			Effect_Names &names = effect_names();
+			std::lock_guard<std::mutex> guard(names.lock);
+			names.names.erase(id());
+		}
+	}
+
+	const char *effect_name(size_t id) {
+		Effect_Names &names = effect_names();
+		std::lock_guard<std::mutex> guard(names.lock);
+		auto found = names.names.find(id);
+		if (found == names.names.end())
+			return nullptr;
+		return found->second;
+	}
+
 	void call_handler(size_t id, Captured_Effect *effect) {
 		Handler_Frame::call_handler(id, effect);
 	}
@@ -15,19 +15,53 @@ namespace effects {
 	void call_handler(size_t id, Captured_Effect *captured);
 
 
-	template <typename Signature>
-	class Effect;
+	// Get the name of an effect, or null if it has no name.
+	const char *effect_name(size_t id);
 
-	template <typename Result, typename... Args>
-	class Effect<Result (Args...)> {
+
+	/**
+	 * Parts of an effect that do not depend on its signature.
+	 */
+	class Effect_Base {
 	public:
+		// Create, optionally with a name. The name is only used for diagnostics, such as traces,
+		// and must outlive the effect.
+		explicit Effect_Base(const char *name = nullptr);
+
+		// Destroy.
+		~Effect_Base();
+
+		// The ID is the address, so effects may not be copied.
+		Effect_Base(const Effect_Base &) = delete;
+		Effect_Base &operator =(const Effect_Base &) = delete;
+
 		// Get a unique ID of the effect.
 		size_t id() const {
 			return reinterpret_cast<size_t>(this);
 		}
 
-		// Call the effect.
-		Result operator ()(Args&& ...args) {
+		// Get the name, if any.
+		const char *name() const {
+			return effect_name;
+		}
+
+	private:
+		// Name of the effect.
+		const char *effect_name;
+	};
+
+
+	template <typename Signature>
+	class Effect;
+
+	template <typename Result, typename... Args>
+	class Effect<Result (Args...)> : public Effect_Base {
+	public:
+		using Effect_Base::Effect_Base;
+
+		// Call the effect. Arguments are taken by value, so that both lvalues and rvalues can be
+		// passed, and moved to the handler.
+		Result operator ()(Args ...args) {
 			// Note: We *can* actually store this on the stack since it will be set exactly once for
 			// each time the handler is called! This works since we are careful to restore the
 			// stacks before setting the result.
@@ -35,7 +69,7 @@ namespace effects {
 
 			call_handler(id(), &bound);
 
-			return bound.result.result();
+			return bound.result.take();
 		}
 	};
 
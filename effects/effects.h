@@ -10,3 +10,11 @@
 #include "handler.h"
 #include "handle.h"
 #include "pointer.h"
+#include "stack_pool.h"
+#include "snapshot.h"
+#include "stack_size.h"
+#include "stats.h"
+#include "trace.h"
+#include "profile.h"
+#include "frames.h"
+#include "allocator.h"
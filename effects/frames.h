@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+
+namespace effects {
+
+	/**
+	 * Inspection of the handler frames of a thread, for sampling profilers and debuggers.
+	 */
+
+	/**
+	 * A handler frame created by handle().
+	 */
+	struct Frame_Info {
+		// Stack of the frame: [stack_base, stack_base + stack_size).
+		void *stack_base = nullptr;
+		size_t stack_size = 0;
+
+		// Saved stack pointer of the frame. Null for the frame that is currently executing.
+		void *stack_pointer = nullptr;
+	};
+
+	// Get the handler frames that are linked on the current thread, starting with the innermost
+	// one. Stores at most "max" frames in "out", and returns the number of frames. Does not
+	// allocate memory or take locks, so it may be called from a signal handler that interrupted
+	// the thread. If the signal arrives while frames are being linked or unlinked, the result
+	// may be incomplete.
+	size_t handler_frames(Frame_Info *out, size_t max);
+
+}
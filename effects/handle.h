@@ -10,15 +10,22 @@ namespace effects {
 	 */
 
 
-	// Handle effects with a handler.
-	template <typename FromType, typename ToType, typename HandleBody>
-	ToType handle(const Handler<ToType, FromType> &handler, HandleBody body) {
+	// Handle effects with a handler, using a stack of size "stack_size". The handler is either a
+	// Handler or a Static_Handler.
+	template <typename HandlerType, typename HandleBody, typename ToType = typename HandlerType::Result_Type>
+	ToType handle(const HandlerType &handler, HandleBody body, const Stack_Size &stack_size) {
 		using Body_Type = Handle_Body_Impl<ToType, HandleBody, decltype(handler.return_handler)>;
 		Shared_Ptr<Body_Type> b = mk_shared<Body_Type>(std::move(body), handler.return_handler);
 
 		// TODO: Heap-allocate with a suitable smart pointer!
-		Handler_Frame::call(b, handler.clauses);
-		return b->result.result();
+		Handler_Frame::call(b, handler.clauses, stack_size);
+		return b->result.take();
+	}
+
+	// Handle effects with a handler.
+	template <typename HandlerType, typename HandleBody, typename ToType = typename HandlerType::Result_Type>
+	ToType handle(const HandlerType &handler, HandleBody body) {
+		return handle(handler, std::move(body), handler.stack_size);
 	}
 
 }
@@ -54,6 +54,7 @@ namespace effects {
 
 	template <typename Function, typename ReturnHandler>
 	class Handle_Body_Impl<void, Function, ReturnHandler> : public Handle_Body_Result<void> {
+	public:
 		Handle_Body_Impl(Function f, ReturnHandler return_handler)
 			: to_call(std::move(f)), return_handler(std::move(return_handler)) {}
 
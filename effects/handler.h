@@ -1,11 +1,15 @@
 #pragma once
 #include "handler_clause.h"
 #include "effect.h"
+#include "stack_size.h"
 #include "debug.h"
 #include <initializer_list>
-#include <unordered_map>
+#include <algorithm>
+#include <vector>
 #include <functional>
 #include <list>
+#include <tuple>
+#include <type_traits>
 #include <memory>
 
 namespace effects {
@@ -14,52 +18,225 @@ namespace effects {
 	 * This file implements handlers for effects.
 	 */
 
-	// Clauses being handled. Effect ID -> handler.
-	using Handler_Clause_Map = std::unordered_map<size_t, Handler_Clause *>;
+	/**
+	 * Table of the clauses in a handler. Effect ID -> clause.
+	 *
+	 * The table is built once when the handler is created, and is then referred to by all handler
+	 * frames created from the handler. Clauses are stored in a flat array sorted by ID, which is
+	 * small enough to be scanned linearly for typical handlers.
+	 */
+	class Handler_Clause_Table {
+	public:
+		// Create an empty table.
+		Handler_Clause_Table() = default;
+
+		// Add a clause. If the effect already has a clause, the first one is kept.
+		void add(Handler_Clause *clause) {
+			auto pos = std::lower_bound(entries.begin(), entries.end(), clause->id, Compare());
+			if (pos == entries.end() || pos->id != clause->id)
+				entries.insert(pos, Entry{clause->id, clause});
+		}
+
+		// Find the clause for an effect. Returns null if not present.
+		Handler_Clause *find(size_t id) const {
+			if (entries.size() <= linear_size) {
+				for (const Entry &e : entries)
+					if (e.id == id)
+						return e.clause;
+				return nullptr;
+			}
+
+			auto pos = std::lower_bound(entries.begin(), entries.end(), id, Compare());
+			if (pos != entries.end() && pos->id == id)
+				return pos->clause;
+			return nullptr;
+		}
+
+		// Number of clauses.
+		size_t size() const {
+			return entries.size();
+		}
+
+	private:
+		struct Entry {
+			size_t id;
+			Handler_Clause *clause;
+		};
+
+		struct Compare {
+			bool operator ()(const Entry &e, size_t id) const {
+				return e.id < id;
+			}
+		};
+
+		// Tables up to this size are searched linearly.
+		static const size_t linear_size = 8;
+
+		// Entries, sorted by ID.
+		std::vector<Entry> entries;
+	};
+
+	/**
+	 * A clause that has not yet been added to a handler. Created by "clause" below. Keeps the
+	 * type of the body, so that it can be used with both "make_handler" and Handler.
+	 */
+	template <typename Signature, typename Body>
+	struct Clause_Init {
+		// Effect handled.
+		size_t id;
 
-	// Helper class for the initializer list.
+		// Body of the clause.
+		Body body;
+	};
+
+	// Create a clause that handles "effect" with "body".
+	template <typename Signature, typename Body>
+	Clause_Init<Signature, std::decay_t<Body>> clause(const Effect<Signature> &effect, Body &&body) {
+		return Clause_Init<Signature, std::decay_t<Body>>{effect.id(), std::forward<Body>(body)};
+	}
+
+	// Helper class for the initializer list. "T" is the result of the handler. The clause is
+	// one-shot if the body accepts a One_Shot_Continuation instead of a Continuation, and
+	// tail-resumptive if the body accepts no continuation at all.
 	template <typename T>
 	class Handler_Init {
 	public:
 		template <typename Signature, typename Body>
 		Handler_Init(const Effect<Signature> &effect, Body &&body)
-			: ptr(std::make_shared<Bound_Handler_Clause<T, Signature>>(effect.id(), std::forward<Body>(body))) {}
+			: ptr(std::make_shared<typename Clause_Type<T, Signature, std::decay_t<Body>>::type>(effect.id(), std::forward<Body>(body))) {}
+
+		template <typename Signature, typename Body>
+		Handler_Init(Clause_Init<Signature, Body> init)
+			: ptr(std::make_shared<typename Clause_Type<T, Signature, Body>::type>(init.id, std::move(init.body))) {}
 
 		std::shared_ptr<Handler_Clause> ptr;
 	};
 
+	/**
+	 * A type-erased handler. The bodies of the clauses and the return handler are stored in
+	 * std::functions. See "make_handler" for a handler that keeps their types.
+	 */
 	template <typename Result, typename Input>
 	class Handler {
 	public:
+		// Result of handling an effect.
+		using Result_Type = Result;
+
 		// Single clause version.
-		Handler(Handler_Init<Input> clause,
-				std::function<Result (Input)> return_handler = [](Input x){ return x; })
-			: return_handler(std::move(return_handler)) {
+		Handler(Handler_Init<Result> clause,
+				std::function<Result (Input)> return_handler = [](Input x){ return x; },
+				Stack_Size stack_size = Stack_Size())
+			: return_handler(std::move(return_handler)), stack_size(std::move(stack_size)) {
 
-			this->clauses.insert(std::make_pair(clause.ptr->id, clause.ptr.get()));
+			this->clauses.add(clause.ptr.get());
 			this->unique_ptrs.push_back(std::move(clause.ptr));
 		}
 
 		// Multiple clause version.
-		Handler(const std::initializer_list<Handler_Init<Input>> &clauses,
-				std::function<Result (Input)> return_handler = [](Input x){ return x; })
-			: return_handler(std::move(return_handler)) {
+		Handler(const std::initializer_list<Handler_Init<Result>> &clauses,
+				std::function<Result (Input)> return_handler = [](Input x){ return x; },
+				Stack_Size stack_size = Stack_Size())
+			: return_handler(std::move(return_handler)), stack_size(std::move(stack_size)) {
 
 			for (auto &&clause : clauses) {
-				this->clauses.insert(std::make_pair(clause.ptr->id, clause.ptr.get()));
+				this->clauses.add(clause.ptr.get());
 				this->unique_ptrs.push_back(std::move(clause.ptr));
 			}
 		}
 
-		// Clauses being handled. Effect ID -> handler.
-		Handler_Clause_Map clauses;
+		// Clauses being handled. Referred to by the frames created by handle(), so the handler
+		// must outlive them.
+		Handler_Clause_Table clauses;
 
 		// Return handler.
 		std::function<Result (Input)> return_handler;
 
+		// Size of the stacks used to execute handled code. Can be overridden in each call to handle().
+		Stack_Size stack_size;
+
 	private:
 		// Store the unique ptrs in a vector.
 		std::vector<std::shared_ptr<Handler_Clause>> unique_ptrs;
 	};
 
+
+	/**
+	 * A handler that stores the clauses and the return handler with their own types, rather than
+	 * in std::functions and shared pointers, so that the compiler is able to inline them. Created
+	 * by "make_handler".
+	 *
+	 * "Clauses" are the types of the clauses (Bound_Handler_Clause or Tail_Handler_Clause). They
+	 * are stored inside the handler, so the handler must outlive any frames created from it.
+	 */
+	template <typename Result, typename Input, typename ReturnHandler, typename... Clauses>
+	class Static_Handler {
+	public:
+		// Result of handling an effect.
+		using Result_Type = Result;
+
+		// Create.
+		template <typename... Inits>
+		Static_Handler(ReturnHandler return_handler, Inits &&...inits)
+			: return_handler(std::move(return_handler)), bound(Clauses(inits.id, std::move(inits.body))...) {
+			fill_table();
+		}
+
+		// Copy and move. The table needs to refer to our own clauses.
+		Static_Handler(const Static_Handler &o)
+			: return_handler(o.return_handler), stack_size(o.stack_size), bound(o.bound) {
+			fill_table();
+		}
+		Static_Handler(Static_Handler &&o)
+			: return_handler(std::move(o.return_handler)), stack_size(std::move(o.stack_size)), bound(std::move(o.bound)) {
+			fill_table();
+		}
+
+		Static_Handler &operator =(const Static_Handler &) = delete;
+
+		// Clauses being handled.
+		Handler_Clause_Table clauses;
+
+		// Return handler.
+		ReturnHandler return_handler;
+
+		// Size of the stacks used to execute handled code. Can be overridden in each call to handle().
+		Stack_Size stack_size;
+
+	private:
+		// The clauses.
+		std::tuple<Clauses...> bound;
+
+		// Add all clauses to the table.
+		void fill_table() {
+			std::apply([this](auto &...clause) { (clauses.add(&clause), ...); }, bound);
+		}
+	};
+
+	// Return handler that returns its input unchanged.
+	struct Identity_Return_Handler {
+		template <typename T>
+		T operator ()(T x) const {
+			return x;
+		}
+	};
+
+	// Create a handler for effects that produce "Input", with clauses created by "clause". The
+	// result of handle() is "Input".
+	template <typename Input, typename... Signatures, typename... Bodies>
+	auto make_handler(Clause_Init<Signatures, Bodies>... clauses) {
+		using Handler_Type = Static_Handler<Input, Input, Identity_Return_Handler,
+											typename Clause_Type<Input, Signatures, Bodies, Bodies>::type...>;
+		return Handler_Type(Identity_Return_Handler(), std::move(clauses)...);
+	}
+
+	// Create a handler with a return handler. The result of handle() is the result of
+	// "return_handler".
+	template <typename Input, typename ReturnHandler, typename... Signatures, typename... Bodies,
+			typename Result = std::decay_t<std::invoke_result_t<ReturnHandler, Input>>>
+	auto make_handler(ReturnHandler return_handler, Clause_Init<Signatures, Bodies>... clauses) {
+		using Handler_Type = Static_Handler<Result, Input, ReturnHandler,
+											typename Clause_Type<Result, Signatures, Bodies, Bodies>::type...>;
+		return Handler_Type(std::move(return_handler), std::move(clauses)...);
+	}
+
 }
@@ -1,5 +1,6 @@
 #pragma once
 #include <functional>
+#include <type_traits>
 #include "continuation.h"
 #include "handle_body.h"
 #include "util.h"
@@ -17,13 +18,25 @@ namespace effects {
 	class Handler_Clause {
 	public:
 		// Create.
-		Handler_Clause(size_t effect_id) : id(effect_id) {}
+		Handler_Clause(size_t effect_id, const void *signature, bool one_shot, bool tail_resumptive = false)
+			: id(effect_id), signature(signature), one_shot(one_shot), tail_resumptive(tail_resumptive) {}
 
 		// Destructor.
 		virtual ~Handler_Clause() = default;
 
 		// Unique ID for the handled effect.
 		const size_t id;
+
+		// Signature of the handled effect ("&type_tag<Signature>"). Since each effect has a single
+		// signature, this always matches the effect with the same ID. It is used to check that
+		// casts to the type of the clause are valid.
+		const void *signature;
+
+		// Does this clause resume its continuation at most once?
+		const bool one_shot;
+
+		// Is this a Tail_Handler_Clause?
+		const bool tail_resumptive;
 	};
 
 	/**
@@ -35,44 +48,158 @@ namespace effects {
 	template <typename EffectResult, typename... Args>
 	class Partial_Handler_Clause<EffectResult (Args...)> : public Handler_Clause {
 	public:
-		Partial_Handler_Clause(size_t effect_id) : Handler_Clause(effect_id) {}
+		Partial_Handler_Clause(size_t effect_id, bool one_shot)
+			: Handler_Clause(effect_id, &type_tag<EffectResult (Args...)>, one_shot) {}
 
+		// Call the body. The arguments are moved into the body.
 		virtual void call(Generic_Result &result_to,
-						const std::tuple<Args...> &args,
+						std::tuple<Args...> &args,
 						const Captured_Continuation &cont,
 						Result<EffectResult> &cont_param_to) const = 0;
 	};
 
 
 	/**
-	 * Fully bound handler.
+	 * Fully bound handler. "OneShot" determines if the body receives a One_Shot_Continuation or a
+	 * regular Continuation. "Body" is the type of the body. If it is void, the body is stored in a
+	 * std::function.
 	 */
-	template <typename Result, typename Signature>
+	template <typename Result, typename Signature, bool OneShot = false, typename Body = void>
 	class Bound_Handler_Clause;
 
-	template <typename HandlerResult, typename EffectResult, typename... Args>
-	class Bound_Handler_Clause<HandlerResult, EffectResult (Args...)>
+	template <typename HandlerResult, typename EffectResult, typename... Args, bool OneShot, typename Body>
+	class Bound_Handler_Clause<HandlerResult, EffectResult (Args...), OneShot, Body>
 		: public Partial_Handler_Clause<EffectResult (Args...)> {
 	public:
-		using Continuation_Type = Continuation<HandlerResult, EffectResult>;
-		using Real_Function = std::function<HandlerResult (Args..., const Continuation_Type &)>;
+		using Continuation_Type = std::conditional_t<OneShot,
+													One_Shot_Continuation<HandlerResult, EffectResult>,
+													Continuation<HandlerResult, EffectResult>>;
+		using Real_Function = std::conditional_t<std::is_void_v<Body>,
+												std::function<HandlerResult (Args..., const Continuation_Type &)>,
+												Body>;
 
 		// Create.
 		Bound_Handler_Clause(size_t effect_id, Real_Function body)
-			: Partial_Handler_Clause<EffectResult (Args...)>(effect_id), body(std::move(body)) {}
+			: Partial_Handler_Clause<EffectResult (Args...)>(effect_id, OneShot), body(std::move(body)) {}
 
 		// Body of the handler.
 		Real_Function body;
 
 		virtual void call(Generic_Result &result_to,
-						const std::tuple<Args...> &args,
+						std::tuple<Args...> &args,
 						const Captured_Continuation &cont,
 						Result<EffectResult> &cont_param_to) const override {
-			Result<HandlerResult> &out = dynamic_cast<Result<HandlerResult> &>(result_to);
+			// Note: The handler frame and its clauses are created from the same handler, so the result
+			// always has the type we expect.
+			Result<HandlerResult> &out = checked_cast<Result<HandlerResult> &>(result_to);
 
 			Continuation_Type c(cont, out, cont_param_to);
-			out.set(Tuple_Call<HandlerResult, std::tuple<Args...>>::call(body, args, c));
+
+			// The arguments live on the performing stack. A multi-shot continuation restores copies
+			// of that stack, so they may only be moved out when the continuation is one-shot.
+			if constexpr (OneShot)
+				out.set(Tuple_Call<HandlerResult, std::tuple<Args...>>::call(body, std::move(args), c));
+			else
+				out.set(Tuple_Call<HandlerResult, std::tuple<Args...>>::call(body, std::as_const(args), c));
+		}
+	};
+
+
+	/**
+	 * Handler clause that always resumes the continuation exactly once, as the last thing it does.
+	 * The body receives the parameters of the effect, and its return value is passed to the
+	 * continuation.
+	 *
+	 * Since the continuation is resumed immediately, there is no need to capture it. The body is
+	 * executed directly on the stack that performed the effect, without switching stacks. Effects
+	 * performed by the body are handled by the handlers outside the handler of the clause, as with
+	 * other clauses.
+	 *
+	 * This class knows only the signature. See Tail_Handler_Clause for the implementation.
+	 */
+	template <typename Signature>
+	class Partial_Tail_Handler_Clause;
+
+	template <typename EffectResult, typename... Args>
+	class Partial_Tail_Handler_Clause<EffectResult (Args...)> : public Handler_Clause {
+	public:
+		Partial_Tail_Handler_Clause(size_t effect_id)
+			: Handler_Clause(effect_id, &type_tag<EffectResult (Args...)>, true, true) {}
+
+		// Call the body, and store the value to resume the continuation with in "result_to". The
+		// arguments are moved into the body.
+		virtual void call(std::tuple<Args...> &args, Result<EffectResult> &result_to) const = 0;
+	};
+
+
+	/**
+	 * Fully bound tail-resumptive handler. "Body" is the type of the body. If it is void, the body
+	 * is stored in a std::function.
+	 */
+	template <typename Signature, typename Body = void>
+	class Tail_Handler_Clause;
+
+	template <typename EffectResult, typename... Args, typename Body>
+	class Tail_Handler_Clause<EffectResult (Args...), Body>
+		: public Partial_Tail_Handler_Clause<EffectResult (Args...)> {
+	public:
+		using Real_Function = std::conditional_t<std::is_void_v<Body>,
+												std::function<EffectResult (Args...)>,
+												Body>;
+
+		// Create.
+		Tail_Handler_Clause(size_t effect_id, Real_Function body)
+			: Partial_Tail_Handler_Clause<EffectResult (Args...)>(effect_id), body(std::move(body)) {}
+
+		// Body of the handler.
+		Real_Function body;
+
+		virtual void call(std::tuple<Args...> &args, Result<EffectResult> &result_to) const override {
+			if constexpr (std::is_void_v<EffectResult>) {
+				Tuple_Call<void, std::tuple<Args...>>::call(body, std::move(args));
+				result_to.set();
+			} else {
+				result_to.set(Tuple_Call<EffectResult, std::tuple<Args...>>::call(body, std::move(args)));
+			}
 		}
 	};
 
+
+	/**
+	 * Find the type of clause to use for a handler body. Bodies that accept a
+	 * One_Shot_Continuation, but not a Continuation, are one-shot. Bodies that accept only the
+	 * parameters of the effect are tail-resumptive.
+	 *
+	 * "Stored" is the type used to store the body in the clause. If void, it is stored in a
+	 * std::function.
+	 */
+	template <typename Result, typename Signature, typename Body, typename Stored, bool TailResumptive>
+	struct Clause_Type_Helper;
+
+	template <typename Result, typename EffectResult, typename... Args, typename Body, typename Stored>
+	struct Clause_Type_Helper<Result, EffectResult (Args...), Body, Stored, true> {
+		using type = Tail_Handler_Clause<EffectResult (Args...), Stored>;
+	};
+
+	template <typename Result, typename EffectResult, typename... Args, typename Body, typename Stored>
+	struct Clause_Type_Helper<Result, EffectResult (Args...), Body, Stored, false> {
+		static const bool one_shot =
+			std::is_invocable_v<Body, Args..., const One_Shot_Continuation<Result, EffectResult> &>
+			&& !std::is_invocable_v<Body, Args..., const Continuation<Result, EffectResult> &>;
+
+		using type = Bound_Handler_Clause<Result, EffectResult (Args...), one_shot, Stored>;
+	};
+
+	template <typename Result, typename Signature, typename Body, typename Stored = void>
+	struct Clause_Type;
+
+	template <typename Result, typename EffectResult, typename... Args, typename Body, typename Stored>
+	struct Clause_Type<Result, EffectResult (Args...), Body, Stored> {
+		// Note: Continuations are only considered for bodies that are not tail-resumptive, so that
+		// effects with a void result may be handled by tail-resumptive clauses.
+		static const bool tail_resumptive = std::is_invocable_r_v<EffectResult, Body, Args...>;
+
+		using type = typename Clause_Type_Helper<Result, EffectResult (Args...), Body, Stored, tail_resumptive>::type;
+	};
+
 }
@@ -1,40 +1,126 @@
 #include "handler_frame.h"
 #include "handle.h"
+#include "stats.h"
+#include "trace.h"
 #include <cassert>
 #include <iostream>
 
 namespace effects {
 
-	// Per-thread link to a handler frame.
+#ifdef EFFECTS_SINGLE_THREADED
+	// The root frame. Stored statically rather than allocated through the allocator hooks, which
+	// are not set yet during static initialization.
+	static Shared_Inline_Count<Handler_Frame> root_frame(Stack::current);
+
+	// Link to the top handler frame. Starts at the root frame, so that we don't need to check for
+	// it. This means that handle() may not be called from static initializers.
+	Shared_Ptr<Handler_Frame> top_handler = Shared_Ptr<Handler_Frame>::unowned(root_frame);
+#else
+	// Per-thread link to a handler frame. The first frame is created lazily, so that it is
+	// allocated through the allocator hooks that are set at the time.
 	thread_local Shared_Ptr<Handler_Frame> top_handler;
+#endif
+
+	/**
+	 * Per-thread cache of handler lookups, to avoid walking the handler frames and searching each
+	 * of them on every effect.
+	 *
+	 * Entries are keyed by the effect and the top frame (and its active tail-resumptive handler,
+	 * if any). Since frames are not modified while they are linked, an entry is valid until a
+	 * frame below the top frame is relinked somewhere else. This is tracked by a generation
+	 * counter, that is incremented whenever a frame is created (as its address may be reused) and
+	 * whenever the "previous" link of a frame is changed. Unlinking frames does not affect the
+	 * frames below, and relinking them in the same place does not change anything either. Thus,
+	 * repeatedly capturing and resuming a continuation keeps the cache valid.
+	 */
+	struct Dispatch_Cache {
+		struct Entry {
+			// Generation when the entry was created.
+			size_t generation = 0;
+
+			// Key.
+			size_t id = 0;
+			Handler_Frame *top = nullptr;
+			Handler_Frame *tail_handler = nullptr;
+
+			// The handler, and the clause to call.
+			Handler_Frame *frame = nullptr;
+			const Handler_Clause *clause = nullptr;
+		};
+
+		// Number of entries. Must be a power of two.
+		static const size_t size = 64;
+
+		// Current generation. Starts at 1 so that empty entries never match.
+		size_t generation = 1;
+
+		// Entries.
+		Entry entries[size];
+
+		// Find the entry for an effect.
+		Entry &operator [](size_t id) {
+			// Effect IDs are addresses, so the low bits are not very useful.
+			return entries[((id >> 4) ^ (id >> 10)) & (size - 1)];
+		}
+	};
+
+	static EFFECTS_THREAD_LOCAL Dispatch_Cache dispatch_cache;
 
 	// Get the current one.
 	Shared_Ptr<Handler_Frame> Handler_Frame::current() {
+#ifndef EFFECTS_SINGLE_THREADED
 		if (!top_handler) {
+			register_thread_stats();
 			top_handler = mk_shared<Handler_Frame>(Stack::current);
 		}
+#endif
 		return top_handler;
 	}
 
-	Handler_Frame::Handler_Frame(Stack::Create create_mode)
-		: stack(create_mode), previous() {}
+	Handler_Frame::Handler_Frame(Stack::Create create_mode, size_t stack_size)
+		: stack(create_mode, stack_size), previous(), clauses(nullptr), body(nullptr), stack_usage(), sample_stack(false), tail_handler(nullptr) {
+
+		// We might be located where a previous frame was.
+		dispatch_cache.generation++;
+		count(stat_frames_created);
+	}
 
 	Handler_Frame::~Handler_Frame() {
+		if (stack_usage) {
+			stack_usage->observe(stack.high_water());
+
+			// Suspended frames only tell us how deep the stack was at the time of suspension. The
+			// stack of a sampling frame started out with no resident pages, so the pages that are
+			// resident now were touched by this frame.
+			if (sample_stack)
+				stack_usage->observe(stack.touched());
+		}
+
 		if (!shared_ptrs.empty()) {
 			std::cerr << "WARNING: Shared pointers are still alive in a handler frame!" << std::endl;
-			for (Shared_Ptr_Base *p : shared_ptrs) {
+			for (Shared_Ptr_Base *p = shared_ptrs.first; p; p = p->next_ptr()) {
 				std::cout << "  Pointer at " << p << ", count-object " << *(void **)p << std::endl;
 			}
 		}
 	}
 
-	void Handler_Frame::call(const Shared_Ptr<Handle_Body> &body, const Handler_Clause_Map &clauses) {
+	void Handler_Frame::call(const Shared_Ptr<Handle_Body> &body, const Handler_Clause_Table &clauses, const Stack_Size &stack_size) {
+		Trace_Scope scope(trace_handle_enter, trace_handle_exit);
+
 		Shared_Ptr<Handler_Frame> current = Handler_Frame::current();
-		Shared_Ptr<Handler_Frame> next = mk_shared<Handler_Frame>(Stack::allocate);
+		Shared_Ptr<Handler_Frame> next = mk_shared<Handler_Frame>(Stack::allocate, stack_size.bytes());
 
 		// Note: Creation of Shared_Ptr above must be before these lines!
 		next->previous = current;
-		next->clauses = clauses; // TODO: Do we really want to copy?
+		if (const auto &usage = stack_size.observed()) {
+			next->stack_usage = usage;
+			if (usage->sample()) {
+				next->sample_stack = true;
+				next->stack.release_all();
+			}
+		}
+		next->clauses = &clauses;
+		next->body = body.get();
 		top_handler = next;
 
 		// Execute the stack!
@@ -44,20 +130,28 @@ namespace effects {
 		// restored "top_frame" at this point.
 
 		// Note: We will return here after execution is complete, or when an effect was triggered.
+		handle_effects(current);
+	}
+
+	void Handler_Frame::handle_effects(const Shared_Ptr<Handler_Frame> &current) {
 		while (current->to_resume.effect) {
 			Resume resume = current->to_resume;
 			current->to_resume = Resume();
 
 			// Capture the continuation and reset the top handler.
-			Captured_Continuation continuation = capture_continuation(top_handler, current);
+			Captured_Continuation continuation = capture_continuation(top_handler, current, resume.to_call->one_shot);
 			top_handler = current;
 
 			// Resume!
+			Abandon_Guard guard(continuation);
 			Resume_Params params = {
-				body.get(),
+				resume.body,
 				resume.to_call,
 				&continuation
 			};
+			Trace_Scope scope(trace_clause_enter, trace_clause_exit, resume.to_call->id);
+			Profile_Scope profile(resume.to_call->id, profile_clause);
+			continuation.profile(resume.to_call->id, profile);
 			resume.effect->call(params);
 		}
 	}
@@ -67,74 +161,202 @@ namespace effects {
 
 		body->call();
 
-		// Unlink:
-		Shared_Ptr<Handler_Frame> current = top_handler;
+		// Unlink, and switch to the previous frame. This is not necessarily the frame that started
+		// this one, since the frame may have been resumed elsewhere as a part of a continuation, so
+		// we can not simply return to the link of the context. The frame is kept alive by whoever
+		// resumed it, and this stack is never resumed again, so nothing here needs to be destroyed.
+		Handler_Frame *current = top_handler.get();
 		top_handler = current->previous;
+		top_handler->stack.resume(current->stack);
+	}
+
+	Handler_Frame *Handler_Frame::find_handler(size_t id, const Handler_Clause *&clause) {
+		Handler_Frame *top = top_handler.get();
+		if (!top)
+			return nullptr;
+
+		Dispatch_Cache::Entry &entry = dispatch_cache[id];
+		if (entry.generation == dispatch_cache.generation
+			&& entry.id == id
+			&& entry.top == top
+			&& entry.tail_handler == top->tail_handler) {
+			clause = entry.clause;
+			return entry.frame;
+		}
+
+		Handler_Frame *current = top;
+		while (current) {
+			// Skip handlers that are not visible from the tail-resumptive clause executing here.
+			if (current->tail_handler) {
+				current = current->tail_handler->previous.get();
+				continue;
+			}
+
+			if (current->clauses && (clause = current->clauses->find(id)))
+				break;
 
-		// Since we messed with the linking here, we need to manually unregister "current":
-		current->shared_ptrs.erase(&current);
+			current = current->previous.get();
+		}
+
+		if (current) {
+			entry.generation = dispatch_cache.generation;
+			entry.id = id;
+			entry.top = top;
+			entry.tail_handler = top->tail_handler;
+			entry.frame = current;
+			entry.clause = clause;
+		}
+		return current;
 	}
 
 	void Handler_Frame::call_handler(size_t id, Captured_Effect *captured) {
-		for (Handler_Frame *current = top_handler.get(); current; current = current->previous.get()) {
-			auto found = current->clauses.find(id);
-			if (found != current->clauses.end()) {
-				Handler_Frame *prev = current->previous.get();
-				assert(prev);
-				prev->call_handler(*found->second, captured);
-				return;
-			}
+		count(stat_effects_performed);
+		trace(trace_perform, id);
+		Profile_Scope profile(id, profile_latency);
+
+		const Handler_Clause *clause = nullptr;
+		Handler_Frame *current = find_handler(id, clause);
+		if (!current)
+			throw no_handler();
+
+		if (clause->tail_resumptive) {
+			// Execute the clause right here. The result is stored directly in "captured".
+			Tail_Guard guard(top_handler.get(), current);
+			Trace_Scope scope(trace_clause_enter, trace_clause_exit, id);
+			Profile_Scope clause_profile(id, profile_clause);
+			captured->call_tail(*clause);
+		} else {
+			Handler_Frame *prev = current->previous.get();
+			assert(prev);
+			prev->call_handler(*clause, captured, current->body);
 		}
-		throw no_handler();
 	}
 
-	void Handler_Frame::call_handler(const Handler_Clause &clause, Captured_Effect *captured) {
+	void Handler_Frame::call_handler(const Handler_Clause &clause, Captured_Effect *captured, Handle_Body *body) {
 		assert(to_resume.effect == nullptr);
 		to_resume.effect = captured;
 		to_resume.to_call = &clause;
+		to_resume.body = body;
 
 		stack.resume(top_handler->stack);
 	}
 
 	Captured_Continuation Handler_Frame::capture_continuation(
 		const Shared_Ptr<Handler_Frame> &from,
-		const Shared_Ptr<Handler_Frame> &to) {
+		const Shared_Ptr<Handler_Frame> &to,
+		bool one_shot) {
 
 		size_t depth = 0;
 		for (Shared_Ptr<Handler_Frame> current = from; current != to; current = current->previous) {
 			depth++;
 		}
 
-		Captured_Continuation captured(depth);
+		Captured_Continuation captured(depth, one_shot);
+		count(stat_continuations_captured);
+		size_t bytes = 0;
 
-		size_t id = 0;
-		for (Shared_Ptr<Handler_Frame> current = from; current != to; current = current->previous, id++) {
-			captured.frames.push_back(Stack_Mirror(current->stack, Pointer_Set(current->shared_ptrs), current));
+		for (Shared_Ptr<Handler_Frame> current = from; current != to; current = current->previous) {
+			current->stack.update_high_water();
+			current->stack.release_unused();
+
+			// One-shot continuations will be resumed at most once, so the stacks will not be
+			// overwritten before they are resumed. No need to copy them.
+			if (one_shot) {
+				captured.handlers.push_back(current);
+			} else {
+				captured.frames.push_back(Stack_Mirror(current->stack, Pointer_Set(current->shared_ptrs), current, current->tail_handler));
+				bytes += captured.frames.back().bytes();
+
+				// The copy owns the references now, and the frame gets them back when the copy is
+				// restored. If the continuation is abandoned, the links on the stack are stale.
+				current->shared_ptrs.clear();
+			}
 		}
 
+		trace(trace_capture, depth, bytes);
+
 		// Copy elision.
 		return captured;
 	}
 
 	void Handler_Frame::resume_continuation(const Captured_Continuation &src) {
-		Stack &save_to = top_handler->stack;
+		Shared_Ptr<Handler_Frame> current = top_handler;
 
-		// Link the handlers into "top_frame". Also update reference counts.
-		for (size_t i = src.frames.size(); i > 0; i--) {
-			const Stack_Mirror &mirror = src.frames[i - 1];
-			const Shared_Ptr<Handler_Frame> &handler = mirror.handler;
+		count(stat_continuations_resumed);
+		trace(trace_resume, src.one_shot ? src.handlers.size() : src.frames.size());
 
-			// Link into the top frame.
-			handler->previous = top_handler;
-			top_handler = handler;
+		// Did we link any frame somewhere else than before? If so, cached lookups are invalid.
+		bool relinked = false;
 
-			// Update ref-counts.
-			handler->shared_ptrs.clear();
-			mirror.shared_ptrs.restore_to(handler->shared_ptrs);
+		if (src.one_shot) {
+			// Link the handlers into "top_frame". Nothing else has touched them since they were
+			// captured.
+			for (size_t i = src.handlers.size(); i > 0; i--) {
+				const Shared_Ptr<Handler_Frame> &handler = src.handlers[i - 1];
+				relinked |= handler->previous != top_handler;
+				handler->previous = top_handler;
+				top_handler = handler;
+			}
+		} else {
+			// Link the handlers into "top_frame". Also update reference counts.
+			for (size_t i = src.frames.size(); i > 0; i--) {
+				const Stack_Mirror &mirror = src.frames[i - 1];
+				const Shared_Ptr<Handler_Frame> &handler = mirror.handler;
+
+				// Link into the top frame.
+				relinked |= handler->previous != top_handler;
+				relinked |= handler->tail_handler != mirror.tail_handler;
+				handler->previous = top_handler;
+				top_handler = handler;
+				handler->tail_handler = mirror.tail_handler;
+
+				// Update ref-counts.
+				mirror.shared_ptrs.restore_to(handler->shared_ptrs);
+			}
 		}
 
+		if (relinked)
+			dispatch_cache.generation++;
+		trace(trace_relink, src.one_shot ? src.handlers.size() : src.frames.size(), relinked);
+
 		// Finally, resume the topmost one:
-		top_handler->stack.resume(save_to);
+		top_handler->stack.resume(current->stack);
+
+		// We get back here when the continuation finished, or when it triggered an effect that we
+		// need to handle.
+		handle_effects(current);
+	}
+
+	void Handler_Frame::abandon_continuation(const Captured_Continuation &src) {
+		// Only relevant for one-shot continuations. Multi-shot continuations own the references of
+		// the Shared_Ptrs in their copies of the stacks.
+		if (!src.one_shot || src.resumed)
+			return;
+
+		// The continuation will never be resumed, so release the references held by Shared_Ptrs
+		// on the abandoned stacks.
+		for (const Shared_Ptr<Handler_Frame> &handler : src.handlers) {
+			Pointer_Set to_release(handler->shared_ptrs);
+			handler->shared_ptrs.clear();
+		}
+	}
+
+	size_t Handler_Frame::frames(Frame_Info *out, size_t max) {
+		size_t count = 0;
+		for (Handler_Frame *at = top_handler.get(); at && at->stack.base(); at = at->previous.get()) {
+			if (count < max) {
+				Frame_Info &info = out[count];
+				info.stack_base = at->stack.base();
+				info.stack_size = at->stack.size();
+				info.stack_pointer = count == 0 ? nullptr : at->stack.stack_pointer();
+			}
+			count++;
+		}
+		return count;
+	}
+
+	size_t handler_frames(Frame_Info *out, size_t max) {
+		return Handler_Frame::frames(out, max);
 	}
 
 	void Handler_Frame::add_shared_ptr(Shared_Ptr_Base *p) {
@@ -145,10 +367,5 @@ namespace effects {
 			c->shared_ptrs.insert(p);
 	}
 
-	void Handler_Frame::remove_shared_ptr(Shared_Ptr_Base *p) {
-		Handler_Frame *c = top_handler.get();
-		if (c && c->stack.contains(p))
-			c->shared_ptrs.erase(p);
-	}
 
 }
@@ -3,7 +3,7 @@
 #include "handler.h"
 #include "captured_effect.h"
 #include "pointer.h"
-#include <unordered_set>
+#include "frames.h"
 
 namespace effects {
 
@@ -25,9 +25,9 @@ namespace effects {
 	 */
 	class Handler_Frame {
 	public:
-		// Create the frame. The parameter is forwarded to the constructor of the Stack member to
+		// Create the frame. The parameters are forwarded to the constructor of the Stack member to
 		// determine how it is created.
-		Handler_Frame(Stack::Create stack_mode);
+		Handler_Frame(Stack::Create stack_mode, size_t stack_size = Stack_Size::default_size);
 
 		// Destroy. Mostly for sanity-checking.
 		~Handler_Frame();
@@ -36,7 +36,7 @@ namespace effects {
 		static Shared_Ptr<Handler_Frame> current();
 
 		// Call a function on a new handler frame.
-		static void call(const Shared_Ptr<Handle_Body> &body, const Handler_Clause_Map &clauses);
+		static void call(const Shared_Ptr<Handle_Body> &body, const Handler_Clause_Table &clauses, const Stack_Size &stack_size);
 
 		// Call an effect handler.
 		static void call_handler(size_t id, Captured_Effect *captured);
@@ -44,18 +44,38 @@ namespace effects {
 		// Resume a continuation. Assumes that all stacks in 'cont' have been restored previously.
 		static void resume_continuation(const Captured_Continuation &cont);
 
+		// Release resources held by a one-shot continuation that will not be resumed.
+		static void abandon_continuation(const Captured_Continuation &cont);
+
+		// Describe the frames linked on this thread. See "handler_frames".
+		static size_t frames(Frame_Info *out, size_t max);
+
 	private:
 		// Stack that this frame executes on.
 		Stack stack;
 
 		// List of shared pointers allocated on the stack.
-		std::unordered_set<Shared_Ptr_Base *> shared_ptrs;
+		Shared_Ptr_List shared_ptrs;
 
 		// Previous frame, if any.
 		Shared_Ptr<Handler_Frame> previous;
 
-		// Clauses handled here.
-		Handler_Clause_Map clauses;
+		// Clauses handled here. Owned by the handler. Null for the first frame of each thread.
+		const Handler_Clause_Table *clauses;
+
+		// Body executed in this frame. Clauses store their result here.
+		Handle_Body *body;
+
+		// Where to report stack usage, if the size of the stack is adaptive.
+		std::shared_ptr<Stack_Size::Usage> stack_usage;
+
+		// Does this frame sample which pages of its stack it touches? See Stack_Size.
+		bool sample_stack;
+
+		// Frame whose tail-resumptive clause is currently executing on this stack, if any. The
+		// clause executes in the context of that handler, so lookups of handlers that reach this
+		// frame continue from the frame before "tail_handler".
+		Handler_Frame *tail_handler;
 
 		/**
 		 * Data structure used to determine what to resume.
@@ -66,6 +86,36 @@ namespace effects {
 
 			// Handler clause to call.
 			const Handler_Clause *to_call = nullptr;
+
+			// Body of the frame that handles the effect.
+			Handle_Body *body = nullptr;
+		};
+
+		/**
+		 * Abandons a continuation that was not resumed when it goes out of scope.
+		 */
+		struct Abandon_Guard {
+			const Captured_Continuation &cont;
+
+			Abandon_Guard(const Captured_Continuation &cont) : cont(cont) {}
+			~Abandon_Guard() {
+				abandon_continuation(cont);
+			}
+		};
+
+		/**
+		 * Marks that a tail-resumptive clause is executing on a frame while in scope.
+		 */
+		struct Tail_Guard {
+			Handler_Frame *frame;
+			Handler_Frame *old;
+
+			Tail_Guard(Handler_Frame *frame, Handler_Frame *handler) : frame(frame), old(frame->tail_handler) {
+				frame->tail_handler = handler;
+			}
+			~Tail_Guard() {
+				frame->tail_handler = old;
+			}
 		};
 
 		// Effect handler to resume.
@@ -74,20 +124,27 @@ namespace effects {
 		// Helper function used as the "main" function for new handler frames.
 		static void frame_main(void *ptr);
 
+		// Find the frame that handles the effect "id", and the clause to call. Returns null if no
+		// handler was found.
+		static Handler_Frame *find_handler(size_t id, const Handler_Clause *&clause);
+
 		// Helper to actually call the handler we found.
-		void call_handler(const Handler_Clause &clause, Captured_Effect *captured);
+		void call_handler(const Handler_Clause &clause, Captured_Effect *captured, Handle_Body *body);
+
+		// Handle effects triggered from frames above "current" after switching back to "current".
+		static void handle_effects(const Shared_Ptr<Handler_Frame> &current);
 
 		// Helper to capture a continuation.
 		static Captured_Continuation capture_continuation(
 			const Shared_Ptr<Handler_Frame> &from,
-			const Shared_Ptr<Handler_Frame> &to);
+			const Shared_Ptr<Handler_Frame> &to,
+			bool one_shot);
 
 		// Allow registering shared ptrs here.
 		friend class Shared_Ptr_Base;
 
-		// Add/remove shared pointers.
+		// Add shared pointers. They remove themselves from the list.
 		static void add_shared_ptr(Shared_Ptr_Base *p);
-		static void remove_shared_ptr(Shared_Ptr_Base *p);
 	};
 
 }
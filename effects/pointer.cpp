@@ -3,12 +3,8 @@
 
 namespace effects {
 
-	Shared_Ptr_Base::Shared_Ptr_Base(Shared_Count *count) : count(count) {
+	Shared_Ptr_Base::Shared_Ptr_Base(Shared_Count *count) : count(count), next(nullptr), prev_next(nullptr) {
 		Handler_Frame::add_shared_ptr(this);
 	}
 
-	Shared_Ptr_Base::~Shared_Ptr_Base() {
-		Handler_Frame::remove_shared_ptr(this);
-	}
-
 }
@@ -2,6 +2,8 @@
 #include <atomic>
 #include <cstddef>
 #include "debug.h"
+#include "config.h"
+#include "allocator.h"
 
 namespace effects {
 
@@ -17,7 +19,11 @@ namespace effects {
 		virtual ~Shared_Count() = default;
 
 		// Reference count. Initialized to 1.
+#ifdef EFFECTS_SINGLE_THREADED
+		size_t refs = 1;
+#else
 		std::atomic<size_t> refs = 1;
+#endif
 
 		// Increase the references.
 		void ref() {
@@ -30,6 +36,25 @@ namespace effects {
 				delete this;
 			}
 		}
+
+		// Counts (and objects stored with them) are allocated by the library's allocator. The
+		// destructor is virtual, so "size" is the size of the derived class.
+		static void *operator new(size_t size) {
+			return effects::allocate(size);
+		}
+
+		static void operator delete(void *memory, size_t size) {
+			effects::deallocate(memory, size);
+		}
+
+		// Over-aligned objects are allocated as usual.
+		static void *operator new(size_t size, std::align_val_t align) {
+			return ::operator new(size, align);
+		}
+
+		static void operator delete(void *memory, size_t size, std::align_val_t align) {
+			::operator delete(memory, size, align);
+		}
 	};
 
 	/**
@@ -65,24 +90,98 @@ namespace effects {
 	};
 
 
+	class Shared_Ptr_Base;
+
+	/**
+	 * List of the Shared_Ptrs located on the stack of a handler frame. The list is intrusive, so
+	 * that registering a pointer does not allocate memory. Since the nodes are located on the
+	 * stack, the links between them are saved and restored along with the stack. Only the head
+	 * of the list needs to be saved separately.
+	 */
+	class Shared_Ptr_List {
+	public:
+		// Create an empty list.
+		Shared_Ptr_List() = default;
+
+		Shared_Ptr_List(const Shared_Ptr_List &) = delete;
+		Shared_Ptr_List &operator =(const Shared_Ptr_List &) = delete;
+
+		// First pointer in the list.
+		Shared_Ptr_Base *first = nullptr;
+
+		// Is the list empty?
+		bool empty() const {
+			return first == nullptr;
+		}
+
+		// Add a pointer.
+		inline void insert(Shared_Ptr_Base *p);
+
+		// Forget all pointers in the list, without unlinking them.
+		void clear() {
+			first = nullptr;
+		}
+	};
+
 	/**
 	 * Base class, to allow managing the Shared_Ptr in the handler_frame:s.
 	 */
 	class Shared_Ptr_Base {
 	public:
-		// Track our life-cycle.
+		// Track our life-cycle. Adds the pointer to the current handler frame if it is located on
+		// its stack.
 		Shared_Ptr_Base(Shared_Count *count);
 
-		~Shared_Ptr_Base();
+		~Shared_Ptr_Base() {
+			unlink();
+		}
+
+		Shared_Ptr_Base(const Shared_Ptr_Base &) = delete;
+		Shared_Ptr_Base &operator =(const Shared_Ptr_Base &) = delete;
+
+		// Next pointer in the list.
+		Shared_Ptr_Base *next_ptr() const {
+			return next;
+		}
 
 	protected:
 		// The count variable. Not updated by the destructor, only accessible here.
 		Shared_Count *count;
 
+		// Remove from the list we are a part of, if any. Does not need to know which list we are
+		// in, so it does not matter if the current handler frame has changed since we were
+		// created.
+		void unlink() {
+			if (prev_next) {
+				*prev_next = next;
+				if (next)
+					next->prev_next = prev_next;
+				next = nullptr;
+				prev_next = nullptr;
+			}
+		}
+
+	private:
+		// Next pointer in the list.
+		Shared_Ptr_Base *next;
+
+		// The pointer that points to us: either "next" of the previous element, or "first" in the
+		// list. Null if we are not in a list.
+		Shared_Ptr_Base **prev_next;
+
 		// Allow use from the pointer set.
 		friend class Pointer_Set;
+		friend class Shared_Ptr_List;
 	};
 
+	void Shared_Ptr_List::insert(Shared_Ptr_Base *p) {
+		p->next = first;
+		p->prev_next = &first;
+		if (first)
+			first->prev_next = &p->next;
+		first = p;
+	}
+
 	/**
 	 * A version of shared_ptr that accounts for the oddities of continuations when doing its
 	 * reference counting.
@@ -138,8 +237,9 @@ namespace effects {
 			return *this;
 		}
 
-		// Destroy.
+		// Destroy. Unlink first, as the count might own the list we are a part of.
 		~Shared_Ptr() {
+			unlink();
 			if (count)
 				count->deref();
 		}
@@ -176,6 +276,17 @@ namespace effects {
 			return object != nullptr;
 		}
 
+		// Number of references to the object. Zero if null.
+		size_t use_count() const {
+			return count ? size_t(count->refs) : 0;
+		}
+
+		// Refer to an object in a count that was not created by mk_shared, for example a static
+		// one. The count keeps its initial reference, so the object is never deleted.
+		static Shared_Ptr<T> unowned(Shared_Inline_Count<T> &count) {
+			return Shared_Ptr<T>(&count, &count.data);
+		}
+
 	private:
 		// The pointer itself.
 		T *object;
@@ -1,6 +1,7 @@
 #pragma once
 #include "pointer.h"
 #include "debug.h"
+#include "stats.h"
 #include <vector>
 
 namespace effects {
@@ -15,39 +16,43 @@ namespace effects {
 		// Create an empty set.
 		Pointer_Set();
 
-		// Create, initialize from a container of Shared_Ptr_Base *.
-		// "steals" the refs in the container, so only used whenever the original
-		// pointers are known to be lost.
-		template <typename Container>
-		explicit Pointer_Set(const Container &c) {
-			elements.reserve(c.size());
-			for (Shared_Ptr_Base *p : c) {
+		// Create, initialize from the pointers in a list. "steals" the refs in the list, so only
+		// used whenever the original pointers are known to be lost. Also remembers the head of the
+		// list, so that it can be restored along with the stack containing the pointers.
+		explicit Pointer_Set(const Shared_Ptr_List &list) : first(list.first) {
+			size_t count = 0;
+			for (Shared_Ptr_Base *p = list.first; p; p = p->next)
+				count++;
+
+			elements.reserve(count);
+			for (Shared_Ptr_Base *p = list.first; p; p = p->next)
 				elements.push_back(Element(p));
-			}
+
+			effects::count(stat_pointer_set_entries, count);
 		}
 
-		// Restore pointers to the specified container.
-		template <typename Container>
-		void restore_to(Container &to) const {
+		// Restore the pointers to "to". Assumes that the stack containing them has been restored,
+		// so that the links between them are intact. The restored pointers get their own
+		// references.
+		void restore_to(Shared_Ptr_List &to) const {
+			to.first = first;
 			for (const Element &e : elements) {
-				to.insert(e.pointer);
 				if (e.count)
 					e.count->ref();
 			}
 		}
 
 	private:
-		// Remember pointers on the stack, and the contents of the pointers at the time the set was
-		// created.
+		// Remember the contents of the pointers on the stack at the time the set was created.
 		class Element {
 		public:
 			// Create.
-			Element(Shared_Ptr_Base *ptr) : pointer(ptr), count(ptr->count) {
+			Element(Shared_Ptr_Base *ptr) : count(ptr->count) {
 				// Note: We don't increase the refcount here, since we should steal the ref!
 			}
 
 			// Copy.
-			Element(const Element &o) : pointer(o.pointer), count(o.count) {
+			Element(const Element &o) : count(o.count) {
 				if (count)
 					count->ref();
 			}
@@ -58,20 +63,17 @@ namespace effects {
 				if (count)
 					count->deref();
 
-				pointer = o.pointer;
 				count = o.count;
 
 				return *this;
 			}
 
 			// Move.
-			Element(Element &&o) : pointer(o.pointer), count(o.count) {
-				o.pointer = nullptr;
+			Element(Element &&o) : count(o.count) {
 				o.count = nullptr;
 			}
 
 			Element &operator =(Element &&o) {
-				std::swap(pointer, o.pointer);
 				std::swap(count, o.count);
 
 				return *this;
@@ -83,16 +85,16 @@ namespace effects {
 					count->deref();
 			}
 
-			// Location of the actual pointer on the stack.
-			Shared_Ptr_Base *pointer;
-
 			// Stored contents of the pointer, so that we can manipulate the reference count without
 			// restoring the stack.
 			Shared_Count *count;
 		};
 
+		// First pointer in the list.
+		Shared_Ptr_Base *first = nullptr;
+
 		// Array of elements.
-		std::vector<Element> elements;
+		std::vector<Element, Allocator<Element>> elements;
 	};
 
 }
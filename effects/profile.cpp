@@ -0,0 +1,210 @@
+#include "profile.h"
+#include "effect.h"
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace effects {
+
+	size_t Latency_Histogram::count() const {
+		size_t result = 0;
+		for (size_t i = 0; i < bucket_count; i++)
+			result += counts[i];
+		return result;
+	}
+
+	double Latency_Histogram::mean() const {
+		size_t n = count();
+		if (n == 0)
+			return 0;
+		return double(sum) / double(n);
+	}
+
+	uint64_t Latency_Histogram::percentile(double fraction) const {
+		size_t n = count();
+		if (n == 0)
+			return 0;
+
+		// Number of values at or below the result.
+		size_t want = size_t(fraction * double(n) + 0.5);
+		want = std::max<size_t>(1, std::min(want, n));
+
+		size_t seen = 0;
+		for (size_t i = 0; i < bucket_count; i++) {
+			seen += counts[i];
+			if (seen >= want)
+				return std::min(bucket_high(i), largest);
+		}
+		return largest;
+	}
+
+	Latency_Histogram &Latency_Histogram::operator +=(const Latency_Histogram &o) {
+		for (size_t i = 0; i < bucket_count; i++)
+			counts[i] += o.counts[i];
+		sum += o.sum;
+		largest = std::max(largest, o.largest);
+		return *this;
+	}
+
+	Latency_Histogram &Latency_Histogram::operator -=(const Latency_Histogram &o) {
+		for (size_t i = 0; i < bucket_count; i++)
+			counts[i] -= o.counts[i];
+		sum -= o.sum;
+		return *this;
+	}
+
+#ifdef EFFECTS_PROFILE
+
+	/**
+	 * Histograms of an effect on a single thread. Only modified by the owning thread, but read by
+	 * other threads, hence the atomics.
+	 */
+	class Profile_Counters {
+	public:
+		struct Histogram {
+			std::atomic<size_t> counts[Latency_Histogram::bucket_count] = {};
+			std::atomic<uint64_t> sum = 0;
+			std::atomic<uint64_t> largest = 0;
+		};
+
+		Histogram histograms[profile_kind_count];
+
+		// Add a value.
+		void record(Profile_Kind kind, uint64_t ns) {
+			Histogram &h = histograms[kind];
+			std::atomic<size_t> &count = h.counts[Latency_Histogram::bucket(ns)];
+			count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			h.sum.store(h.sum.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+			if (ns > h.largest.load(std::memory_order_relaxed))
+				h.largest.store(ns, std::memory_order_relaxed);
+		}
+
+		// Add our values to "to".
+		void add_to(Effect_Profile &to) const {
+			add_to(to.latency, histograms[profile_latency]);
+			add_to(to.clause, histograms[profile_clause]);
+			add_to(to.resume, histograms[profile_resume]);
+		}
+
+	private:
+		static void add_to(Latency_Histogram &to, const Histogram &from) {
+			for (size_t i = 0; i < Latency_Histogram::bucket_count; i++)
+				to.counts[i] += from.counts[i].load(std::memory_order_relaxed);
+			to.sum += from.sum.load(std::memory_order_relaxed);
+			to.largest = std::max(to.largest, from.largest.load(std::memory_order_relaxed));
+		}
+	};
+
+	// Profiles by effect ID.
+	typedef std::unordered_map<size_t, Effect_Profile> Profile_Map;
+
+	// Lock for the variables below, and for adding effects to the profiles of a thread.
+	static std::mutex registry_lock;
+
+	// Profiles of all running threads.
+	class Profile_Thread;
+	static std::vector<Profile_Thread *> registry;
+
+	// Sum of the profiles of threads that have exited.
+	static Profile_Map retired;
+
+	/**
+	 * Profiles of the current thread. Only the owning thread adds effects (with "registry_lock"
+	 * held), so it may look them up without the lock.
+	 */
+	class Profile_Thread {
+	public:
+		Profile_Thread() {
+			std::lock_guard<std::mutex> guard(registry_lock);
+			registry.push_back(this);
+		}
+
+		~Profile_Thread() {
+			std::lock_guard<std::mutex> guard(registry_lock);
+			add_to(retired);
+			registry.erase(std::find(registry.begin(), registry.end(), this));
+		}
+
+		// Get the counters for an effect.
+		Profile_Counters &operator [](size_t id) {
+			auto found = effects.find(id);
+			if (found != effects.end())
+				return *found->second;
+
+			std::lock_guard<std::mutex> guard(registry_lock);
+			return *(effects[id] = std::make_unique<Profile_Counters>());
+		}
+
+		// Add our profiles to "to". "registry_lock" must be held.
+		void add_to(Profile_Map &to) const {
+			for (const auto &e : effects) {
+				Effect_Profile &profile = to[e.first];
+				profile.id = e.first;
+				e.second->add_to(profile);
+			}
+		}
+
+	private:
+		std::unordered_map<size_t, std::unique_ptr<Profile_Counters>> effects;
+	};
+
+	static EFFECTS_THREAD_LOCAL Profile_Thread profile_thread;
+
+	void profile_record(size_t id, Profile_Kind kind, uint64_t ns) {
+		profile_thread[id].record(kind, ns);
+	}
+
+	// Sum the profiles of all threads.
+	static Profile_Map all_profiles() {
+		std::lock_guard<std::mutex> guard(registry_lock);
+		Profile_Map result = retired;
+		for (const Profile_Thread *t : registry)
+			t->add_to(result);
+		return result;
+	}
+
+	std::vector<Effect_Profile> effect_profiles() {
+		Profile_Map profiles = all_profiles();
+
+		std::vector<Effect_Profile> result;
+		result.reserve(profiles.size());
+		for (auto &p : profiles) {
+			p.second.name = effect_name(p.first);
+			result.push_back(std::move(p.second));
+		}
+
+		std::sort(result.begin(), result.end(), [](const Effect_Profile &a, const Effect_Profile &b) {
+			return a.id < b.id;
+		});
+		return result;
+	}
+
+	Effect_Profile effect_profile(size_t id) {
+		Profile_Map profiles = all_profiles();
+
+		Effect_Profile result;
+		auto found = profiles.find(id);
+		if (found != profiles.end())
+			result = found->second;
+		result.id = id;
+		result.name = effect_name(id);
+		return result;
+	}
+
+#else
+
+	std::vector<Effect_Profile> effect_profiles() {
+		return std::vector<Effect_Profile>();
+	}
+
+	Effect_Profile effect_profile(size_t id) {
+		Effect_Profile result;
+		result.id = id;
+		result.name = effect_name(id);
+		return result;
+	}
+
+#endif
+
+}
@@ -0,0 +1,206 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "config.h"
+
+namespace effects {
+
+	/**
+	 * Per-effect latency profiling.
+	 *
+	 * When the library is compiled with EFFECTS_PROFILE, the time taken by each effect is recorded
+	 * in histograms, one set for each effect. Three things are measured:
+	 * - latency: from the effect is performed until it returns, including the handler clause and
+	 *   any resumptions of the continuation.
+	 * - clause: time spent in the handler clause, excluding resumptions of the continuation.
+	 * - resume: time spent resuming the continuation, from the resumption starts (including
+	 *   restoring stacks) until control returns to the clause. Since handlers are deep, this
+	 *   includes the clauses of effects performed by the continuation that are handled by the same
+	 *   handler.
+	 *
+	 * Each thread records into its own histograms. "effect_profiles" sums them over all threads.
+	 * Histograms are cumulative. Subtract an earlier snapshot to get the latencies of an interval.
+	 *
+	 * Performs whose continuations are never resumed are not included in "latency".
+	 *
+	 * Without EFFECTS_PROFILE, nothing is recorded and "effect_profiles" returns nothing. The
+	 * macro must be defined consistently for the library and for code that uses it.
+	 */
+
+
+	/**
+	 * Histogram of latencies in nanoseconds. Values are stored in buckets with logarithmic size:
+	 * each power of two is divided into "sub_buckets" buckets, so a value is known to within 12.5%
+	 * regardless of its size.
+	 */
+	class Latency_Histogram {
+	public:
+		// Number of buckets for each power of two.
+		static const size_t sub_buckets = 8;
+
+		// Total number of buckets.
+		static const size_t bucket_count = (64 - 2) * sub_buckets;
+
+		// Find the bucket for a value.
+		static size_t bucket(uint64_t ns) {
+			if (ns < sub_buckets)
+				return size_t(ns);
+			size_t exponent = 63 - __builtin_clzll(ns);
+			return (exponent - 2) * sub_buckets + size_t((ns >> (exponent - 3)) & (sub_buckets - 1));
+		}
+
+		// Smallest value in a bucket.
+		static uint64_t bucket_low(size_t bucket) {
+			if (bucket < sub_buckets)
+				return bucket;
+			size_t exponent = bucket / sub_buckets + 2;
+			return uint64_t(sub_buckets + bucket % sub_buckets) << (exponent - 3);
+		}
+
+		// Largest value in a bucket.
+		static uint64_t bucket_high(size_t bucket) {
+			if (bucket + 1 >= bucket_count)
+				return UINT64_MAX;
+			return bucket_low(bucket + 1) - 1;
+		}
+
+		// Add a value.
+		void record(uint64_t ns) {
+			counts[bucket(ns)]++;
+			sum += ns;
+			if (ns > largest)
+				largest = ns;
+		}
+
+		// Number of values.
+		size_t count() const;
+
+		// Number of values in a bucket.
+		size_t count(size_t bucket) const {
+			return counts[bucket];
+		}
+
+		// Sum of all values.
+		uint64_t total() const {
+			return sum;
+		}
+
+		// Largest value. Not affected by subtraction.
+		uint64_t max() const {
+			return largest;
+		}
+
+		// Mean value. 0 if empty.
+		double mean() const;
+
+		// Value below which "fraction" (0-1) of the values lie. Returns the upper bound of the
+		// bucket containing the value, so the result is never too low. 0 if empty.
+		uint64_t percentile(double fraction) const;
+
+		// Add the values of another histogram.
+		Latency_Histogram &operator +=(const Latency_Histogram &o);
+
+		// Remove the values of an earlier snapshot of the same histogram.
+		Latency_Histogram &operator -=(const Latency_Histogram &o);
+
+	private:
+		friend class Profile_Counters;
+
+		// Count in each bucket.
+		size_t counts[bucket_count] = {};
+
+		// Sum of the values.
+		uint64_t sum = 0;
+
+		// Largest value.
+		uint64_t largest = 0;
+	};
+
+
+	/**
+	 * Histograms for an effect.
+	 */
+	struct Effect_Profile {
+		// The effect.
+		size_t id = 0;
+
+		// Name of the effect, if it has a name and still exists.
+		const char *name = nullptr;
+
+		// Time from perform to return.
+		Latency_Histogram latency;
+
+		// Time in the handler clause, excluding resumptions.
+		Latency_Histogram clause;
+
+		// Time resuming continuations of the effect.
+		Latency_Histogram resume;
+	};
+
+	// Get the profiles of all effects that have been performed, summed over all threads.
+	std::vector<Effect_Profile> effect_profiles();
+
+	// Get the profile of a single effect. Empty if the effect has not been performed.
+	Effect_Profile effect_profile(size_t id);
+
+
+	// Kinds of measurements. In the same order as in Effect_Profile.
+	enum Profile_Kind {
+		profile_latency,
+		profile_clause,
+		profile_resume,
+		profile_kind_count
+	};
+
+	// Current time, in nanoseconds.
+	inline uint64_t profile_now() {
+		using namespace std::chrono;
+		return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+	}
+
+#ifdef EFFECTS_PROFILE
+
+	// Record a measurement for an effect on the current thread.
+	void profile_record(size_t id, Profile_Kind kind, uint64_t ns);
+
+	/**
+	 * Measures the time until it is destroyed, and records it for an effect. Time that is
+	 * reported to "exclude" is subtracted.
+	 */
+	class Profile_Scope {
+	public:
+		Profile_Scope(size_t id, Profile_Kind kind) : id(id), kind(kind), start(profile_now()) {}
+
+		~Profile_Scope() {
+			profile_record(id, kind, profile_now() - start - excluded);
+		}
+
+		Profile_Scope(const Profile_Scope &) = delete;
+		Profile_Scope &operator =(const Profile_Scope &) = delete;
+
+		// Exclude time from the measurement.
+		void exclude(uint64_t ns) {
+			excluded += ns;
+		}
+
+	private:
+		size_t id;
+		Profile_Kind kind;
+		uint64_t start;
+		uint64_t excluded = 0;
+	};
+
+#else
+
+	class Profile_Scope {
+	public:
+		Profile_Scope(size_t, Profile_Kind) {}
+		void exclude(uint64_t) {}
+	};
+
+#endif
+
+}
@@ -30,9 +30,24 @@ namespace effects {
 			}
 		}
 
-		// Set the result.
-		void set(T value) {
-			this->value = std::move(value);
+		// Move the result out, leaving the result empty so that it can be set again. Works for
+		// move-only types, and avoids copying large ones.
+		T take() {
+			if (error) {
+				std::exception_ptr e = std::move(error);
+				error = nullptr;
+				std::rethrow_exception(e);
+			}
+
+			T result = std::move(value.value());
+			value.reset();
+			return result;
+		}
+
+		// Set the result. The value is constructed in place from "value".
+		template <typename U>
+		void set(U &&value) {
+			this->value.emplace(std::forward<U>(value));
 		}
 
 		// Set an error. Called from a try-block.
@@ -65,6 +80,15 @@ namespace effects {
 			}
 		}
 
+		// Same as "result", but clears any error.
+		void take() {
+			if (error) {
+				std::exception_ptr e = std::move(error);
+				error = nullptr;
+				std::rethrow_exception(e);
+			}
+		}
+
 		// Set the result.
 		void set() {}
 
@@ -0,0 +1,805 @@
+#include "snapshot.h"
+#include "stats.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+
+namespace effects {
+
+	static std::atomic<bool> config_copy_on_write = false;
+	static std::atomic<bool> config_deduplicate = false;
+	static std::atomic<bool> config_compactable = false;
+	static std::atomic<size_t> config_max_mapped_runs = Snapshot_Config().max_mapped_runs;
+
+	Snapshot_Config snapshot_config() {
+		Snapshot_Config result;
+		result.copy_on_write = config_copy_on_write.load(std::memory_order_relaxed);
+		result.deduplicate = config_deduplicate.load(std::memory_order_relaxed);
+		result.compactable = config_compactable.load(std::memory_order_relaxed);
+		result.max_mapped_runs = config_max_mapped_runs.load(std::memory_order_relaxed);
+		return result;
+	}
+
+	void snapshot_config(const Snapshot_Config &config) {
+		config_copy_on_write.store(config.copy_on_write, std::memory_order_relaxed);
+		config_deduplicate.store(config.deduplicate, std::memory_order_relaxed);
+		config_compactable.store(config.compactable, std::memory_order_relaxed);
+		config_max_mapped_runs.store(config.max_mapped_runs, std::memory_order_relaxed);
+	}
+
+	// Memory usage. Updated whenever snapshots and pages are created or destroyed, which happens
+	// far less often than bytes are copied.
+	static std::atomic<size_t> usage_count = 0;
+	static std::atomic<size_t> usage_logical = 0;
+	static std::atomic<size_t> usage_physical = 0;
+
+	Snapshot_Memory_Usage snapshot_memory_usage() {
+		Snapshot_Memory_Usage result;
+		result.count = usage_count.load(std::memory_order_relaxed);
+		result.logical = usage_logical.load(std::memory_order_relaxed);
+		result.physical = usage_physical.load(std::memory_order_relaxed);
+		return result;
+	}
+
+	// Get the page size.
+	static size_t page_size() {
+		static size_t sz = static_cast<size_t>(getpagesize());
+		return sz;
+	}
+
+	// Copy "size" bytes from "from" to "to", but only write the pages that differ. Restoring a
+	// snapshot usually overwrites data that is mostly the same, e.g. when a continuation is
+	// resumed repeatedly. The comparison stops at the first difference in each page, so it costs
+	// about as much as copying when everything changed. Blocks are aligned to the end of "to",
+	// which is the top of the stack. Returns the number of bytes written.
+	static size_t copy_changed(char *to, const char *from, size_t size) {
+		size_t written = 0;
+		for (size_t end = size; end > 0; ) {
+			size_t at = end > page_size() ? end - page_size() : 0;
+			if (std::memcmp(to + at, from + at, end - at) != 0) {
+				std::memcpy(to + at, from + at, end - at);
+				written += end - at;
+			}
+			end = at;
+		}
+		return written;
+	}
+
+	// Hash the contents of a page. Uses four independent lanes so that the multiplications can
+	// overlap.
+	static uint64_t hash_page(const char *data) {
+		const uint64_t k = 0x9e3779b97f4a7c15;
+		uint64_t h[4] = { 1, 2, 3, 4 };
+		for (size_t i = 0; i < page_size(); i += sizeof(h)) {
+			for (size_t j = 0; j < 4; j++) {
+				uint64_t w;
+				std::memcpy(&w, data + i + j * sizeof(w), sizeof(w));
+				h[j] = (h[j] ^ w) * k;
+			}
+		}
+		uint64_t result = h[0] ^ (h[1] >> 7) ^ (h[2] >> 15) ^ (h[3] >> 31);
+		return result ^ (result >> 29);
+	}
+
+	/**
+	 * Pages that can be found by their contents. Shared by all threads.
+	 */
+	class Page_Index {
+	public:
+		// Find a page with the same contents as "data", and add a reference to it. Only considers
+		// pages in the memory file if "in_file" is set. Returns null if there is none.
+		Snapshot_Page *find(uint64_t hash, const char *data, bool in_file) {
+			std::lock_guard<std::mutex> guard(lock);
+
+			auto range = pages.equal_range(hash);
+			for (auto i = range.first; i != range.second; ++i) {
+				Snapshot_Page *page = i->second;
+				if (in_file && page->offset == Snapshot_Page::no_offset)
+					continue;
+				if (std::memcmp(page->data, data, page_size()) != 0)
+					continue;
+
+				// Pages without references are being released, and must not be revived.
+				size_t refs = page->refs.load(std::memory_order_relaxed);
+				while (refs > 0) {
+					if (page->refs.compare_exchange_weak(refs, refs + 1, std::memory_order_relaxed))
+						return page;
+				}
+			}
+			return nullptr;
+		}
+
+		// Add a page.
+		void insert(Snapshot_Page *page, uint64_t hash) {
+			std::lock_guard<std::mutex> guard(lock);
+			page->hash = hash;
+			page->indexed = true;
+			pages.emplace(hash, page);
+		}
+
+		// Remove a page that has no references.
+		void erase(Snapshot_Page *page) {
+			std::lock_guard<std::mutex> guard(lock);
+
+			auto range = pages.equal_range(page->hash);
+			for (auto i = range.first; i != range.second; ++i) {
+				if (i->second == page) {
+					pages.erase(i);
+					break;
+				}
+			}
+			page->indexed = false;
+		}
+
+	private:
+		// Lock for the pages.
+		std::mutex lock;
+
+		// Pages by hash.
+		std::unordered_multimap<uint64_t, Snapshot_Page *> pages;
+	};
+
+	// The index. Never destroyed, since snapshots may outlive static objects.
+	static Page_Index &page_index() {
+		static Page_Index *index = new Page_Index();
+		return *index;
+	}
+
+	// Allocate a page on the heap, with a single reference.
+	static Snapshot_Page *allocate_heap_page() {
+		Snapshot_Page *page = new Snapshot_Page;
+		page->refs.store(1, std::memory_order_relaxed);
+		page->data = static_cast<char *>(allocate(page_size()));
+		page->offset = Snapshot_Page::no_offset;
+		page->hash = 0;
+		page->indexed = false;
+		usage_physical.fetch_add(page_size(), std::memory_order_relaxed);
+		return page;
+	}
+
+	// Release a page on the heap.
+	static void release_heap_page(Snapshot_Page *page) {
+		deallocate(page->data, page_size());
+		delete page;
+		usage_physical.fetch_sub(page_size(), std::memory_order_relaxed);
+	}
+
+#if defined(__linux__)
+
+	/**
+	 * The memory file. Grows in chunks, each of which is mapped shared so that pages can be
+	 * written. Released pages are punched out of the file, and their offsets are reused.
+	 */
+	class Page_Store {
+	public:
+		Page_Store() {
+			fd = memfd_create("effects-snapshots", MFD_CLOEXEC);
+		}
+
+		// Is the store usable?
+		bool usable() const {
+			return fd >= 0;
+		}
+
+		// The file.
+		int fd;
+
+		// Allocate a page with a single reference. Throws std::bad_alloc on failure.
+		Snapshot_Page *allocate() {
+			std::lock_guard<std::mutex> guard(lock);
+
+			Snapshot_Page *page;
+			if (!free.empty()) {
+				page = free.back();
+				free.pop_back();
+			} else {
+				if (used == chunks.size() * chunk_size)
+					grow();
+				page = new Snapshot_Page;
+				page->offset = used;
+				page->data = chunks.back() + (used % chunk_size);
+				used += page_size();
+			}
+
+			page->refs.store(1, std::memory_order_relaxed);
+			page->hash = 0;
+			page->indexed = false;
+			usage_physical.fetch_add(page_size(), std::memory_order_relaxed);
+			return page;
+		}
+
+		// Release a page.
+		void release(Snapshot_Page *page) {
+			fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, page->offset, page_size());
+			usage_physical.fetch_sub(page_size(), std::memory_order_relaxed);
+
+			std::lock_guard<std::mutex> guard(lock);
+			free.push_back(page);
+		}
+
+	private:
+		// Size of each chunk.
+		static const size_t chunk_size = 64 * 1024 * 1024;
+
+		// Lock for the members below.
+		std::mutex lock;
+
+		// Mapping of each chunk.
+		std::vector<char *> chunks;
+
+		// Bytes of the file used so far.
+		size_t used = 0;
+
+		// Released pages.
+		std::vector<Snapshot_Page *> free;
+
+		// Add a chunk.
+		void grow() {
+			size_t offset = chunks.size() * chunk_size;
+			if (ftruncate(fd, offset + chunk_size) != 0)
+				throw std::bad_alloc();
+
+			void *memory = mmap(nullptr, chunk_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+			if (memory == MAP_FAILED)
+				throw std::bad_alloc();
+			chunks.push_back(static_cast<char *>(memory));
+		}
+	};
+
+	// The store. Never destroyed, since snapshots may outlive static objects.
+	static Page_Store &page_store() {
+		static Page_Store *store = new Page_Store();
+		return *store;
+	}
+
+	void release_snapshot_page(Snapshot_Page *page) {
+		if (page->indexed)
+			page_index().erase(page);
+
+		if (page->offset == Snapshot_Page::no_offset)
+			release_heap_page(page);
+		else
+			page_store().release(page);
+	}
+
+	// Find which of "count" pages from "start" still have the contents of the file page they
+	// map, i.e. they have not been written since they were mapped. If this can not be
+	// determined, all pages are considered written.
+	static void find_clean(char *start, size_t count, std::vector<bool> &clean) {
+		static int pagemap = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+
+		clean.assign(count, false);
+		if (pagemap < 0 || count == 0)
+			return;
+
+		const size_t batch = 512;
+		uint64_t entries[batch];
+		for (size_t first = 0; first < count; first += batch) {
+			size_t n = std::min(batch, count - first);
+			off_t offset = off_t(reinterpret_cast<size_t>(start) / page_size() + first) * sizeof(uint64_t);
+			if (pread(pagemap, entries, n * sizeof(uint64_t), offset) != ssize_t(n * sizeof(uint64_t)))
+				return;
+
+			for (size_t i = 0; i < n; i++) {
+				bool present = (entries[i] >> 63) & 1;
+				bool swapped = (entries[i] >> 62) & 1;
+				bool file = (entries[i] >> 61) & 1;
+
+				// Pages that are not present read from the file when touched. Written pages are
+				// anonymous.
+				clean[first + i] = present ? file : !swapped;
+			}
+		}
+	}
+
+	// Map "pages" pages of the file starting at "offset" privately at "to". Returns false if the
+	// kernel refused, in which case the previous contents of the range may be lost.
+	static bool map_pages(char *to, size_t offset, size_t pages) {
+		void *result = mmap(to, pages * page_size(), PROT_READ | PROT_WRITE,
+							MAP_PRIVATE | MAP_FIXED, page_store().fd, offset);
+		if (result == MAP_FAILED)
+			return false;
+		count(stat_pages_mapped, pages);
+		return true;
+	}
+
+	// Replace the range [to, to + size) with anonymous memory.
+	static void map_anonymous(void *to, size_t size) {
+		// Note: The slabs are mapped the same way, so the kernel may merge the mappings again.
+		void *result = mmap(to, size, PROT_READ | PROT_WRITE,
+							MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+		if (result == MAP_FAILED)
+			throw std::bad_alloc();
+	}
+
+	/**
+	 * Helper to map runs of consecutive pages onto a stack with a single system call each. Each
+	 * run may split the mapping of the stack, so the number of runs mapped onto a stack is
+	 * limited by "max_mapped_runs". Pages beyond the limit, or that the kernel refuses to map,
+	 * are copied instead, and are not marked as mapped.
+	 */
+	class Map_Batch {
+	public:
+		// Create, for a stack whose top is at "top".
+		Map_Batch(Stack_Mapping &mapping, char *top) : mapping(mapping), top(top) {}
+
+		// Add a page to map at "to". The caller marks it as mapped. Returns the number of bytes
+		// copied when mapping the previous run, as "flush".
+		size_t add(char *to, const Snapshot_Page *page) {
+			size_t bytes = count * page_size();
+			if (count > 0 && to == start + bytes && page->offset == offset + bytes && page->data == data + bytes) {
+				count++;
+				return 0;
+			}
+			size_t copied = flush();
+			start = to;
+			offset = page->offset;
+			data = page->data;
+			count = 1;
+			return copied;
+		}
+
+		// Map the pending pages. Returns the number of bytes that were copied instead.
+		size_t flush() {
+			size_t bytes = count * page_size();
+			size_t copied = 0;
+			if (count == 0) {
+				return 0;
+			} else if (mapping.runs < config_max_mapped_runs.load(std::memory_order_relaxed)) {
+				mapping.runs++;
+				if (!map_pages(start, offset, count)) {
+					map_anonymous(start, bytes);
+					std::memcpy(start, data, bytes);
+					copied = bytes;
+					unmark();
+				}
+			} else {
+				copied = copy_changed(start, data, bytes);
+				unmark();
+			}
+			count = 0;
+			return copied;
+		}
+
+	private:
+		Stack_Mapping &mapping;
+		char *top;
+
+		// Pending run.
+		char *start = nullptr;
+		size_t offset = 0;
+		const char *data = nullptr;
+		size_t count = 0;
+
+		// Mark the pending pages as not mapped.
+		void unmark() {
+			size_t last = (top - start) / page_size();
+			for (size_t i = last - count; i < last; i++)
+				mapping.pages[i] = Snapshot_Page_Ref();
+		}
+	};
+
+	void Stack_Mapping::reset(void *base, size_t size) {
+		if (runs > 0) {
+			// Only the part of the stack that pages were mapped onto.
+			char *top = static_cast<char *>(base) + size;
+			map_anonymous(top - pages.size() * page_size(), pages.size() * page_size());
+		}
+		pages.clear();
+		runs = 0;
+	}
+
+	// Use pages?
+	static bool use_pages() {
+		return config_copy_on_write.load(std::memory_order_relaxed) && page_store().usable();
+	}
+
+#else
+
+	void release_snapshot_page(Snapshot_Page *page) {
+		if (page->indexed)
+			page_index().erase(page);
+		release_heap_page(page);
+	}
+
+	void Stack_Mapping::reset(void *, size_t) {}
+
+	static bool use_pages() {
+		return false;
+	}
+
+#endif
+
+	// Load the word at index "i" of "from".
+	static inline uint64_t load_word(const char *from, size_t i) {
+		uint64_t w;
+		std::memcpy(&w, from + i * sizeof(w), sizeof(w));
+		return w;
+	}
+
+	// Longest run of words encoded by a single tag.
+	static const size_t max_run = 128;
+
+	// Compress "size" bytes from "from". Words are encoded in runs, each starting with a tag byte.
+	// The low 7 bits of the tag are the length of the run minus one. If the high bit is clear, the
+	// run consists of zeros. Otherwise, each word in the run is stored as the difference from the
+	// previous nonzero word, zig-zag encoded as a varint. Bytes after the last whole word are
+	// stored as they are.
+	static void compress(const char *from, size_t size, std::vector<char, Allocator<char>> &to) {
+		size_t words = size / sizeof(uint64_t);
+		uint64_t previous = 0;
+
+		for (size_t i = 0; i < words; ) {
+			bool zero = load_word(from, i) == 0;
+			size_t run = 1;
+			while (run < max_run && i + run < words && (load_word(from, i + run) == 0) == zero)
+				run++;
+
+			to.push_back(char((zero ? 0x00 : 0x80) | (run - 1)));
+			for (size_t j = i; !zero && j < i + run; j++) {
+				uint64_t w = load_word(from, j);
+				uint64_t delta = w - previous;
+				uint64_t z = (delta << 1) ^ uint64_t(int64_t(delta) >> 63);
+				previous = w;
+
+				for (; z >= 0x80; z >>= 7)
+					to.push_back(char(0x80 | (z & 0x7f)));
+				to.push_back(char(z));
+			}
+			i += run;
+		}
+
+		to.insert(to.end(), from + words * sizeof(uint64_t), from + size);
+	}
+
+	// Decompress "from" into "size" bytes at "to".
+	static void decompress(const char *from, char *to, size_t size) {
+		const unsigned char *at = reinterpret_cast<const unsigned char *>(from);
+		size_t words = size / sizeof(uint64_t);
+		uint64_t previous = 0;
+
+		for (size_t i = 0; i < words; ) {
+			unsigned char tag = *at++;
+			size_t run = (tag & 0x7f) + 1;
+
+			if (tag & 0x80) {
+				for (size_t j = i; j < i + run; j++) {
+					uint64_t z = 0;
+					for (unsigned shift = 0; ; shift += 7) {
+						unsigned char b = *at++;
+						z |= uint64_t(b & 0x7f) << shift;
+						if (!(b & 0x80))
+							break;
+					}
+
+					previous += (z >> 1) ^ (~(z & 1) + 1);
+					std::memcpy(to + j * sizeof(previous), &previous, sizeof(previous));
+				}
+			} else {
+				std::memset(to + i * sizeof(uint64_t), 0, run * sizeof(uint64_t));
+			}
+			i += run;
+		}
+
+		std::memcpy(to + words * sizeof(uint64_t), at, size - words * sizeof(uint64_t));
+	}
+
+	/**
+	 * List of all Compactable_Bytes.
+	 */
+	struct Compactable_List {
+		// Lock for the list.
+		std::mutex lock;
+
+		// First element.
+		Compactable_Bytes *first = nullptr;
+	};
+
+	// The list. Never destroyed, since snapshots may outlive static objects.
+	static Compactable_List &compactable_list() {
+		static Compactable_List *list = new Compactable_List();
+		return *list;
+	}
+
+	/**
+	 * Bytes of a snapshot that may be compressed by "compact_snapshots". Linked into the list
+	 * while alive.
+	 */
+	class Compactable_Bytes {
+	public:
+		// Store the bytes [from, to).
+		Compactable_Bytes(const char *from, const char *to)
+			: size(to - from), data(from, to), last_used(std::chrono::steady_clock::now()) {
+			link();
+		}
+
+		// Copy. Compressed bytes are copied as they are.
+		Compactable_Bytes(Compactable_Bytes &o) {
+			std::lock_guard<std::mutex> guard(o.lock);
+			data = o.data;
+			size = o.size;
+			compressed = o.compressed;
+			last_used = o.last_used;
+			link();
+		}
+
+		~Compactable_Bytes() {
+			Compactable_List &list = compactable_list();
+			{
+				std::lock_guard<std::mutex> guard(list.lock);
+				if (prev)
+					prev->next = next;
+				else
+					list.first = next;
+				if (next)
+					next->prev = prev;
+			}
+			usage_physical.fetch_sub(data.size(), std::memory_order_relaxed);
+		}
+
+		// Size when not compressed.
+		size_t size;
+
+		// Write the bytes to "to", decompressing them if necessary. Returns the number of bytes
+		// written.
+		size_t restore(char *to) {
+			std::lock_guard<std::mutex> guard(lock);
+			last_used = std::chrono::steady_clock::now();
+
+			// The snapshot is in use again, so keep it decompressed.
+			if (compressed) {
+				Byte_Buffer raw(size);
+				decompress(data.data(), raw.data(), size);
+				usage_physical.fetch_add(raw.size() - data.size(), std::memory_order_relaxed);
+				data = std::move(raw);
+				compressed = false;
+			}
+
+			return copy_changed(to, data.data(), size);
+		}
+
+		// Compress the bytes if they have not been used since "before". Returns the number of
+		// bytes saved. Called with the list locked.
+		size_t compact(std::chrono::steady_clock::time_point before, std::vector<char, Allocator<char>> &buffer) {
+			std::unique_lock<std::mutex> guard(lock, std::try_to_lock);
+			if (!guard || compressed || last_used > before)
+				return 0;
+
+			buffer.clear();
+			compress(data.data(), data.size(), buffer);
+			if (buffer.size() >= data.size())
+				return 0;
+
+			size_t saved = data.size() - buffer.size();
+			data.assign(buffer.data(), buffer.data() + buffer.size());
+			compressed = true;
+			usage_physical.fetch_sub(saved, std::memory_order_relaxed);
+			return saved;
+		}
+
+		// Position in the list.
+		Compactable_Bytes *prev = nullptr;
+		Compactable_Bytes *next = nullptr;
+
+	private:
+		// Lock for the members below. "compact_snapshots" skips the bytes if it is taken.
+		std::mutex lock;
+
+		// The bytes, possibly compressed.
+		Byte_Buffer data;
+
+		// Is "data" compressed?
+		bool compressed = false;
+
+		// Last time the bytes were captured or restored.
+		std::chrono::steady_clock::time_point last_used;
+
+		// Add to the list.
+		void link() {
+			usage_physical.fetch_add(data.size(), std::memory_order_relaxed);
+
+			Compactable_List &list = compactable_list();
+			std::lock_guard<std::mutex> guard(list.lock);
+			next = list.first;
+			if (next)
+				next->prev = this;
+			list.first = this;
+		}
+	};
+
+	size_t compact_snapshots(std::chrono::steady_clock::duration idle) {
+		std::chrono::steady_clock::time_point before = std::chrono::steady_clock::now() - idle;
+		std::vector<char, Allocator<char>> buffer;
+		size_t saved = 0;
+
+		Compactable_List &list = compactable_list();
+		std::lock_guard<std::mutex> guard(list.lock);
+		for (Compactable_Bytes *at = list.first; at; at = at->next)
+			saved += at->compact(before, buffer);
+		return saved;
+	}
+
+	void Stack_Snapshot::capture_head(const char *from, const char *to) {
+		count(stat_bytes_captured, to - from);
+		if (config_compactable.load(std::memory_order_relaxed))
+			compactable.reset(new Compactable_Bytes(from, to));
+		else
+			head.assign(from, to);
+	}
+
+	size_t Stack_Snapshot::head_size() const {
+		return compactable ? compactable->size : head.size();
+	}
+
+	// Find a stored page with the same contents as the page at "at", or store a copy of it. The
+	// page is stored in the memory file if "in_file" is set, otherwise anywhere.
+	static Snapshot_Page_Ref store_page(const char *at, bool in_file, bool deduplicate) {
+		uint64_t hash = 0;
+		if (deduplicate) {
+			hash = hash_page(at);
+			if (Snapshot_Page *found = page_index().find(hash, at, in_file)) {
+				count(stat_pages_shared);
+				return Snapshot_Page_Ref(found);
+			}
+		}
+
+#if defined(__linux__)
+		Snapshot_Page_Ref copy(in_file ? page_store().allocate() : allocate_heap_page());
+#else
+		Snapshot_Page_Ref copy(allocate_heap_page());
+#endif
+		std::memcpy(copy.get()->data, at, page_size());
+		count(stat_bytes_captured, page_size());
+
+		if (deduplicate)
+			page_index().insert(copy.get(), hash);
+		return copy;
+	}
+
+	Stack_Snapshot::Stack_Snapshot(Stack_Mapping &mapping, char *from, char *top) {
+		size_t page_size = effects::page_size();
+		char *first_page = reinterpret_cast<char *>((reinterpret_cast<size_t>(from) + page_size - 1) & ~(page_size - 1));
+		bool deduplicate = config_deduplicate.load(std::memory_order_relaxed);
+		copy_on_write = use_pages();
+
+		if ((!copy_on_write && !deduplicate) || first_page >= top) {
+			capture_head(from, top);
+			copy_on_write = false;
+			add_usage(1);
+			return;
+		}
+
+		capture_head(from, first_page);
+
+		size_t page_count = (top - first_page) / page_size;
+		pages.reserve(page_count);
+
+		if (!copy_on_write) {
+			for (size_t i = 0; i < page_count; i++)
+				pages.push_back(store_page(first_page + i * page_size, false, true));
+			add_usage(1);
+			return;
+		}
+
+#if defined(__linux__)
+		if (mapping.pages.size() < page_count)
+			mapping.pages.resize(page_count);
+
+		std::vector<bool> clean;
+		find_clean(first_page, page_count, clean);
+
+		Map_Batch batch(mapping, top);
+		for (size_t i = 0; i < page_count; i++) {
+			char *at = first_page + i * page_size;
+			Snapshot_Page_Ref &mapped = mapping.pages[page_count - 1 - i];
+
+			if (mapped && clean[i]) {
+				pages.push_back(mapped);
+				continue;
+			}
+
+			// Store the page, and map the stored page in its place, so that it does not need to
+			// be stored again unless it is written.
+			Snapshot_Page_Ref stored = store_page(at, true, deduplicate);
+			batch.add(at, stored.get());
+			mapped = stored;
+			pages.push_back(std::move(stored));
+		}
+		batch.flush();
+#else
+		(void)mapping;
+#endif
+		add_usage(1);
+	}
+
+	Stack_Snapshot::Stack_Snapshot(const Stack_Snapshot &o)
+		: head(o.head),
+		  compactable(o.compactable ? new Compactable_Bytes(*o.compactable) : nullptr),
+		  pages(o.pages),
+		  copy_on_write(o.copy_on_write) {
+		add_usage(1);
+	}
+
+	Stack_Snapshot::Stack_Snapshot() = default;
+
+	Stack_Snapshot::Stack_Snapshot(Stack_Snapshot &&o) = default;
+
+	Stack_Snapshot &Stack_Snapshot::operator =(Stack_Snapshot o) {
+		std::swap(head, o.head);
+		std::swap(compactable, o.compactable);
+		std::swap(pages, o.pages);
+		std::swap(copy_on_write, o.copy_on_write);
+		return *this;
+	}
+
+	Stack_Snapshot::~Stack_Snapshot() {
+		add_usage(-1);
+	}
+
+	void Stack_Snapshot::add_usage(int sign) const {
+		size_t bytes = size();
+		if (bytes == 0)
+			return;
+
+		if (sign > 0) {
+			usage_count.fetch_add(1, std::memory_order_relaxed);
+			usage_logical.fetch_add(bytes, std::memory_order_relaxed);
+			usage_physical.fetch_add(head.size(), std::memory_order_relaxed);
+		} else {
+			usage_count.fetch_sub(1, std::memory_order_relaxed);
+			usage_logical.fetch_sub(bytes, std::memory_order_relaxed);
+			usage_physical.fetch_sub(head.size(), std::memory_order_relaxed);
+		}
+	}
+
+	void Stack_Snapshot::restore(Stack_Mapping &mapping, char *top) const {
+		size_t page_size = effects::page_size();
+		char *first_page = top - pages.size() * page_size;
+
+		size_t written = 0;
+		if (compactable)
+			written = compactable->restore(first_page - compactable->size);
+		else
+			written = copy_changed(first_page - head.size(), head.data(), head.size());
+		if (!copy_on_write) {
+			for (size_t i = 0; i < pages.size(); i++)
+				written += copy_changed(first_page + i * page_size, pages[i].get()->data, page_size);
+			count(stat_bytes_restored, written);
+			return;
+		}
+
+#if defined(__linux__)
+
+		size_t page_count = pages.size();
+		if (mapping.pages.size() < page_count)
+			mapping.pages.resize(page_count);
+
+		std::vector<bool> clean;
+		find_clean(first_page, page_count, clean);
+
+		Map_Batch batch(mapping, top);
+		for (size_t i = 0; i < page_count; i++) {
+			Snapshot_Page_Ref &mapped = mapping.pages[page_count - 1 - i];
+			if (mapped.get() == pages[i].get() && clean[i])
+				continue;
+
+			written += batch.add(first_page + i * page_size, pages[i].get());
+			mapped = pages[i];
+		}
+		written += batch.flush();
+#else
+		(void)mapping;
+#endif
+		count(stat_bytes_restored, written);
+	}
+
+	size_t Stack_Snapshot::size() const {
+		return head_size() + pages.size() * page_size();
+	}
+
+}
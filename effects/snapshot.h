@@ -0,0 +1,233 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <cstdint>
+#include <vector>
+#include "allocator.h"
+
+namespace effects {
+
+	/**
+	 * Storage of stack snapshots.
+	 *
+	 * Multi-shot continuations keep a copy of the used part of each captured stack (see
+	 * Stack_Mirror). By default, the stack is copied into memory when the continuation is
+	 * captured, and copied back each time the continuation is resumed. When copying back, only
+	 * pages that differ from the stack are written. A continuation that is resumed repeatedly
+	 * tends to modify little of the stack, so this avoids most of the writes.
+	 *
+	 * With "copy_on_write", whole pages of the stack are instead stored in a memory file (memfd)
+	 * that is shared by all threads. Restoring a snapshot maps its pages privately onto the stack,
+	 * so that the OS copies a page only when it is written. Capturing a stack copies only the
+	 * pages that have been written since they were mapped, and maps the copies in their place.
+	 * Thus, the deep part of a stack that is captured and resumed repeatedly is neither copied nor
+	 * restored again, and the cost of both depends on the pages that were written rather than on
+	 * the depth of the stack. Mapping pages requires system calls, so this is only worthwhile for
+	 * deep stacks. Only available on Linux. Elsewhere, the setting is ignored.
+	 *
+	 * Pages are mapped in runs of pages that are consecutive in the memory file. Each run splits
+	 * the mapping of the stack, and costs up to two mappings (VMAs), which count towards the limit
+	 * of the process (vm.max_map_count, 65530 by default). Pages that were deduplicated or that
+	 * reuse freed space in the file are rarely consecutive, so a deep stack could otherwise need a
+	 * mapping for each page. The number of runs mapped onto each stack is therefore limited by
+	 * "max_mapped_runs", and further pages are copied instead, as without "copy_on_write". The
+	 * count is reset when the stack is returned to the pool. Pages that the kernel refuses to map
+	 * are copied as well.
+	 *
+	 * With "deduplicate", whole pages of snapshots are stored by content, so that a page that is
+	 * identical to one in another live snapshot is stored only once. This is useful when many
+	 * continuations are captured from similar stacks, as in search, where the deep part of the
+	 * stacks is the same. Pages of copied snapshots are then stored separately from the partial
+	 * page at the bottom of the stack. Finding identical pages requires hashing the pages that
+	 * are copied, which makes capturing somewhat more expensive.
+	 *
+	 * With "compactable", the bytes that a snapshot stores by itself (i.e. not in pages) may be
+	 * compressed by "compact_snapshots" when they have not been used for a while. This is meant
+	 * for continuations that stay suspended for a long time, e.g. while waiting for a client.
+	 * Stacks contain mostly zeros and pointers close to each other, so they are encoded as runs
+	 * of zeros and differences between words. Compressed snapshots are decompressed when they are
+	 * restored. Snapshots that are compactable are kept in a list, which requires taking a lock
+	 * when they are created and destroyed.
+	 */
+	struct Snapshot_Config {
+		// Store snapshots as copy-on-write pages.
+		bool copy_on_write = false;
+
+		// Share identical pages between snapshots.
+		bool deduplicate = false;
+
+		// Allow "compact_snapshots" to compress the snapshots.
+		bool compactable = false;
+
+		// Maximum number of runs of pages to map onto each stack with "copy_on_write".
+		size_t max_mapped_runs = 64;
+	};
+
+	// Get/set the configuration. Affects snapshots captured after the call.
+	Snapshot_Config snapshot_config();
+	void snapshot_config(const Snapshot_Config &config);
+
+	// Compress the compactable snapshots of all threads that have not been captured or restored
+	// during the last "idle" time. Snapshots that are being restored are skipped. Returns the
+	// number of bytes saved.
+	size_t compact_snapshots(std::chrono::steady_clock::duration idle);
+
+
+	/**
+	 * Memory used by the live snapshots.
+	 */
+	struct Snapshot_Memory_Usage {
+		// Number of snapshots. A continuation contains one snapshot for each captured stack, and
+		// copying a continuation copies them.
+		size_t count = 0;
+
+		// Bytes of stacks in the snapshots.
+		size_t logical = 0;
+
+		// Bytes used to store the snapshots. Pages shared between snapshots are counted once.
+		size_t physical = 0;
+	};
+
+	// Get the memory used by the live snapshots of all threads.
+	Snapshot_Memory_Usage snapshot_memory_usage();
+
+
+	/**
+	 * A page of a snapshot, either in the memory file or on the heap. Immutable once written, and
+	 * shared between snapshots.
+	 */
+	class Snapshot_Page {
+	public:
+		// Offset of pages that are not in the memory file.
+		static const size_t no_offset = ~size_t(0);
+
+		// Number of references.
+		std::atomic<size_t> refs;
+
+		// Contents of the page, in the shared mapping of the file or on the heap.
+		char *data;
+
+		// Offset in the file, or "no_offset".
+		size_t offset;
+
+		// Hash of the contents, if the page can be found by its contents.
+		uint64_t hash;
+		bool indexed;
+	};
+
+	// Release a page. Called when the last reference disappears.
+	void release_snapshot_page(Snapshot_Page *page);
+
+	/**
+	 * Reference to a Snapshot_Page.
+	 */
+	class Snapshot_Page_Ref {
+	public:
+		// Create, taking over a reference to "page".
+		explicit Snapshot_Page_Ref(Snapshot_Page *page = nullptr) : page(page) {}
+
+		Snapshot_Page_Ref(const Snapshot_Page_Ref &o) : page(o.page) {
+			if (page)
+				page->refs.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		Snapshot_Page_Ref(Snapshot_Page_Ref &&o) : page(o.page) {
+			o.page = nullptr;
+		}
+
+		Snapshot_Page_Ref &operator =(Snapshot_Page_Ref o) {
+			std::swap(page, o.page);
+			return *this;
+		}
+
+		~Snapshot_Page_Ref() {
+			if (page && page->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				release_snapshot_page(page);
+		}
+
+		Snapshot_Page *get() const {
+			return page;
+		}
+
+		explicit operator bool() const {
+			return page != nullptr;
+		}
+
+	private:
+		Snapshot_Page *page;
+	};
+
+
+	/**
+	 * Pages of the memory file that are mapped onto a stack. A mapped page has the contents of the
+	 * file page unless it has been written since it was mapped.
+	 */
+	class Stack_Mapping {
+	public:
+		// Mapped pages, starting from the topmost page of the stack. Null if not mapped.
+		std::vector<Snapshot_Page_Ref> pages;
+
+		// Number of runs of pages that have been mapped onto the stack. See "max_mapped_runs".
+		size_t runs = 0;
+
+		// Replace any mapped pages in the stack [base, base + size) with anonymous memory. Does
+		// nothing if no pages were mapped.
+		void reset(void *base, size_t size);
+	};
+
+
+	// Bytes of a snapshot that may be compressed.
+	class Compactable_Bytes;
+
+	/**
+	 * A snapshot of the range [from, top) of a stack, where "top" is the (page aligned) top of the
+	 * stack.
+	 */
+	class Stack_Snapshot {
+	public:
+		// Create an empty snapshot.
+		Stack_Snapshot();
+
+		// Capture the range [from, top) of a stack.
+		Stack_Snapshot(Stack_Mapping &mapping, char *from, char *top);
+
+		// Copy. Pages are shared.
+		Stack_Snapshot(const Stack_Snapshot &o);
+		Stack_Snapshot(Stack_Snapshot &&o);
+		Stack_Snapshot &operator =(Stack_Snapshot o);
+
+		~Stack_Snapshot();
+
+		// Restore the range to the stack it was captured from.
+		void restore(Stack_Mapping &mapping, char *top) const;
+
+		// Number of bytes in the snapshot.
+		size_t size() const;
+
+	private:
+		// Bytes below the first whole page. If the snapshot does not use pages, all bytes.
+		Byte_Buffer head;
+
+		// The same bytes, if the snapshot is compactable. "head" is then empty.
+		std::unique_ptr<Compactable_Bytes> compactable;
+
+		// Whole pages, from low to high addresses.
+		std::vector<Snapshot_Page_Ref> pages;
+
+		// Are the pages mapped onto the stack when restoring, rather than copied?
+		bool copy_on_write = false;
+
+		// Add (or remove) this snapshot to the memory usage. Compactable bytes keep track of
+		// their own physical size.
+		void add_usage(int sign) const;
+
+		// Store the bytes [from, to) as "head" or "compactable".
+		void capture_head(const char *from, const char *to);
+
+		// Number of bytes below the first whole page.
+		size_t head_size() const;
+	};
+
+}
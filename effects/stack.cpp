@@ -1,161 +1,260 @@
 #include "stack.h"
+#include "stack_pool.h"
+#include "config.h"
+#include "stats.h"
 #include "debug.h"
 #include <unistd.h>
 #include <sys/mman.h>
-#include <new>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
 
 namespace effects {
 
-	// Size of a stack:
-	static const size_t stack_size = 1 * 1024 * 1024; // 1 MiB
+	/**
+	 * Stacks allocated by a thread.
+	 *
+	 * A stack may be destroyed by another thread than the one that allocated it, and may outlive
+	 * its thread. The owning thread is by far the most common user of the list, so it modifies the
+	 * list without taking the lock unless another thread is using it at the same time. Other
+	 * threads, and all threads after the owner has exited, take the lock. When the owner has
+	 * exited, the last stack to leave the list deletes it.
+	 */
+	struct Live_Stacks {
+		// First stack in the list.
+		Stack *first = nullptr;
+
+		// Has the thread exited?
+		bool orphaned = false;
+
+#ifndef EFFECTS_SINGLE_THREADED
+		// Lock for the list, for threads other than the owner.
+		std::mutex lock;
+
+		// Is the owner using the list without the lock?
+		std::atomic<bool> owner_busy = false;
+
+		// Number of other threads that are using the list or waiting to do so.
+		std::atomic<size_t> others = 0;
+#endif
 
-	// Get the current page size.
-	static size_t page_size() {
-		static size_t sz = 0;
-		if (sz == 0) {
-			int s = getpagesize();
-			sz = static_cast<size_t>(s);
+		// Call "fn" from the owning thread. "fn" may use the list.
+		template <typename Fn>
+		void owner(Fn fn) {
+#ifndef EFFECTS_SINGLE_THREADED
+			// Announce that we are using the list, then check for other threads. Other threads do
+			// the opposite, so at least one of us notices the other.
+			owner_busy.store(true);
+			if (others.load() != 0) {
+				owner_busy.store(false, std::memory_order_release);
+				std::lock_guard<std::mutex> guard(lock);
+				fn();
+				return;
+			}
+#endif
+			fn();
+#ifndef EFFECTS_SINGLE_THREADED
+			owner_busy.store(false, std::memory_order_release);
+#endif
 		}
-		return sz;
-	}
-
-
-	Stack::Stack(Create mode) : stack_base(nullptr), stack_size(0) {
-		getcontext(&context);
 
-		if (mode == allocate) {
-			size_t page_size = effects::page_size();
-			size_t size = ((effects::stack_size + page_size - 1) / page_size) * page_size; // Round up.
-			size += page_size; // Guard page.
+		// Call "fn" from another thread, or after the owning thread has exited. "fn" may use the
+		// list. Returns true if the list is orphaned and empty, and should be deleted.
+		template <typename Fn>
+		bool other(Fn fn) {
+#ifndef EFFECTS_SINGLE_THREADED
+			others.fetch_add(1);
+			while (owner_busy.load())
+				std::this_thread::yield();
+
+			std::lock_guard<std::mutex> guard(lock);
+			fn();
+			others.fetch_sub(1, std::memory_order_release);
+#else
+			fn();
+#endif
+			return orphaned && first == nullptr;
+		}
+	};
 
-			void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-			if (!memory)
-				throw std::bad_alloc();
+	/**
+	 * Owns the list of a thread.
+	 */
+	struct Live_Stacks_Owner {
+		Live_Stacks *list = new Live_Stacks();
+
+		~Live_Stacks_Owner() {
+			Live_Stacks *l = list;
+			list = nullptr;
+			if (l->other([l]() { l->orphaned = true; }))
+				delete l;
+		}
+	};
 
-			mprotect(memory, 1, PROT_NONE); // For the guard page.
+	// Allocated stacks on this thread.
+	static EFFECTS_THREAD_LOCAL Live_Stacks_Owner live_stacks;
 
-			this->stack_base = static_cast<char *>(memory) + page_size;
-			this->stack_size = size - page_size;
+	Stack::Stack(Create mode, size_t size)
+		: stack_base(nullptr), stack_size(0), max_used(0), dirty(0), live(nullptr), prev_live(nullptr), next_live(nullptr) {
 
-			context.uc_stack.ss_sp = stack_base;
-			context.uc_stack.ss_size = stack_size;
+		if (mode == allocate) {
+			Stack_Memory memory = Stack_Pool::allocate(size);
+			this->stack_base = memory.base;
+			this->stack_size = memory.size;
+
+			count(stat_stacks_live);
+
+			// Null if the thread is exiting.
+			live = live_stacks.list;
+			if (!live)
+				return;
+
+			live->owner([this]() {
+				next_live = live->first;
+				if (next_live)
+					next_live->prev_live = this;
+				live->first = this;
+			});
 		}
 	}
 
 	Stack::~Stack() {
-		if (!stack_base) {
-			size_t page_size = effects::page_size();
-			void *base = static_cast<char *>(stack_base) - page_size;
-			munmap(base, stack_size + page_size);
+		if (stack_base && live) {
+			auto unlink = [this]() {
+				if (prev_live)
+					prev_live->next_live = next_live;
+				else
+					live->first = next_live;
+				if (next_live)
+					next_live->prev_live = prev_live;
+			};
+
+			if (live == live_stacks.list)
+				live->owner(unlink);
+			else if (live->other(unlink))
+				delete live;
+		}
+
+		if (stack_base) {
+			count_down(stat_stacks_live);
+
+			mapping.reset(stack_base, stack_size);
+
+			Stack_Memory memory;
+			memory.base = stack_base;
+			memory.size = stack_size;
+			Stack_Pool::release(memory);
 		}
 	}
 
 	void Stack::start(Stack &prev, void (*fn)(void *), void *param) {
-		context.uc_link = &prev.context;
-		makecontext(&context, reinterpret_cast<void (*)()>(fn), 1, param);
-		swapcontext(&prev.context, &context);
+		context.prepare(stack_base, stack_size, &prev.context, fn, param);
+		count(stat_context_switches);
+		Context::swap(prev.context, context);
 	}
 
 	void Stack::resume(Stack &prev) {
-		swapcontext(&prev.context, &context);
+		count(stat_context_switches);
+		Context::swap(prev.context, context);
 	}
 
-	std::ostream &operator <<(std::ostream &to, const Stack &s) {
-		void *end = reinterpret_cast<char *>(s.stack_base) + s.stack_size;
-		return to << "Stack: " << s.stack_base << " - " << end;
+	void Stack::release_unused() {
+		size_t used = this->used();
+		if (dirty < used + Stack_Pool::release_threshold())
+			return;
+
+		char *top = static_cast<char *>(stack_base) + stack_size;
+		Stack_Pool::discard(top - dirty, top - used);
+		dirty = used;
 	}
 
-	static size_t get_sp(const ucontext_t &context) {
-#if defined(__linux__)
+	void Stack::release_all() {
+		Stack_Pool::discard(stack_base, static_cast<char *>(stack_base) + stack_size, false);
+	}
 
-#if defined(__x86_64__)
-		return context.uc_mcontext.gregs[REG_RSP];
-#elif defined(__aarch64__)
-		return context.uc_mcontext.sp;
-#else
-#error "Unknown machine, can not extract the stack pointer."
-		return 0;
-#endif
+	size_t Stack::resident() const {
+		if (!stack_base)
+			return 0;
+		return Stack_Pool::resident(stack_base, static_cast<char *>(stack_base) + stack_size);
+	}
 
-#elif defined(__APPLE__)
+	Stack_Memory_Usage Stack::live_usage() {
+		Stack_Memory_Usage result;
+		Live_Stacks *live = live_stacks.list;
+		if (!live)
+			return result;
+
+		live->owner([live, &result]() {
+			for (Stack *at = live->first; at; at = at->next_live) {
+				result.count++;
+				result.reserved += at->stack_size;
+				result.resident += at->resident();
+			}
+		});
+		return result;
+	}
 
-		// Note: The mcontext is a pointer, we probably need to store that as well!
-#if defined(__x86_64)
-#if __DARWIN_UNIX03
-		return context.uc_mcontext->__ss.__rsp;
-#else
-		return context.uc_mcontext->ss.rsp;
-#endif
-#elif defined(__aarch64__)
-#if __DARWIN_UNIX03
-		return context.uc_mcontext->__ss.__sp;
-#else
-		return context.uc_mcontext->ss.sp;
-#endif
-#else
-#error "Unknown machine, can not extract the stack pointer."
-		return 0;
-#endif
+	size_t Stack::touched() const {
+		if (!stack_base)
+			return 0;
+
+		size_t page_size = static_cast<size_t>(getpagesize());
+		size_t pages = stack_size / page_size;
 
+		// Examine the stack in chunks from the bottom, so that we can stop at the first resident page.
+		const size_t chunk = 64;
+#if defined(__APPLE__)
+		char resident[chunk];
 #else
-#error "Unknown platform."
+		unsigned char resident[chunk];
 #endif
-	}
-
-	template <typename T>
-	struct Save_MContext {
-		static void save(T &context, std::vector<char> &store) {
-			// Only need to do something if the member is a pointer!
-			(void)context;
-			(void)store;
+		for (size_t first = 0; first < pages; first += chunk) {
+			size_t count = std::min(chunk, pages - first);
+			char *start = static_cast<char *>(stack_base) + first * page_size;
+			if (mincore(start, count * page_size, resident) != 0)
+				return stack_size;
+
+			for (size_t i = 0; i < count; i++)
+				if (resident[i] & 1)
+					return stack_size - (first + i) * page_size;
 		}
-	};
 
-	template <typename T>
-	struct Save_MContext<T *> {
-		// Only need to do something if the member is a pointer!
-		static void save(T *&context, std::vector<char> &store) {
-			const char *begin = reinterpret_cast<const char *>(context);
-			const char *end = begin + sizeof(T);
-			store = std::vector<char>(begin, end);
-
-			// Store the updated pointer back!
-			context = reinterpret_cast<T *>(store.data());
-		}
-	};
+		return 0;
+	}
 
-	static void save_mcontext(ucontext_t &context, std::vector<char> &store) {
-		using Type = std::remove_cv_t<std::remove_reference_t<decltype(context.uc_mcontext)>>;
-		Save_MContext<Type>::save(context.uc_mcontext, store);
+	std::ostream &operator <<(std::ostream &to, const Stack &s) {
+		void *end = reinterpret_cast<char *>(s.stack_base) + s.stack_size;
+		return to << "Stack: " << s.stack_base << " - " << end;
 	}
 
-	Stack_Mirror::Stack_Mirror(Stack &src, Pointer_Set ptrs, Shared_Ptr<Handler_Frame> handler)
-		: handler(std::move(handler)), shared_ptrs(std::move(ptrs)), original(&src) {
+	Stack_Mirror::Stack_Mirror(Stack &src, Pointer_Set ptrs, Shared_Ptr<Handler_Frame> handler, Handler_Frame *tail_handler)
+		: handler(std::move(handler)), tail_handler(tail_handler), shared_ptrs(std::move(ptrs)), original(&src) {
 
 		context = src.context;
 
-		size_t stack_low = reinterpret_cast<size_t>(context.uc_stack.ss_sp);
-		size_t stack_high = stack_low + context.uc_stack.ss_size;
+		size_t stack_low = reinterpret_cast<size_t>(src.stack_base);
+		size_t stack_high = stack_low + src.stack_size;
 
-		size_t sp = get_sp(context);
+		size_t sp = context.stack_pointer();
 
+#ifndef EFFECTS_ASM_CONTEXT
 		// Save the machine context if we need to do that.
-		save_mcontext(context, state_copy);
+		context.save_state(state_copy);
+#endif
 
 		// Note: We assume that stack grows towards lower adresses.
-		char *copy_start = reinterpret_cast<char *>(sp);
-		size_t to_copy = stack_high - sp;
-		stack_copy = std::vector<char>(copy_start, copy_start + to_copy);
+		stack_copy = Stack_Snapshot(src.mapping, reinterpret_cast<char *>(sp), reinterpret_cast<char *>(stack_high));
 	}
 
 	void Stack_Mirror::restore() const {
 		original->context = context;
 
-		size_t stack_low = reinterpret_cast<size_t>(context.uc_stack.ss_sp);
-		size_t stack_high = stack_low + context.uc_stack.ss_size;
+		size_t stack_low = reinterpret_cast<size_t>(original->stack_base);
+		size_t stack_high = stack_low + original->stack_size;
 
-		char *copy_to = reinterpret_cast<char *>(stack_high - stack_copy.size());
-		std::copy(stack_copy.begin(), stack_copy.end(), copy_to);
+		stack_copy.restore(original->mapping, reinterpret_cast<char *>(stack_high));
+		original->note_used(stack_copy.size());
 	}
 
 }
@@ -1,12 +1,16 @@
 #pragma once
-#include <ucontext.h>
 #include <vector>
 #include <iostream>
 #include "pointer_set.h"
+#include "context.h"
+#include "stack_size.h"
+#include "stack_pool.h"
+#include "snapshot.h"
 
 namespace effects {
 
 	class Handler_Frame;
+	struct Live_Stacks;
 
 	/**
 	 * This file contains logic for manipulation of different execution stacks on a thread.
@@ -24,8 +28,9 @@ namespace effects {
 			allocate, // Allocate a new stack.
 		};
 
-		// Create a new stack, but do not execute it yet.
-		Stack(Create mode);
+		// Create a new stack, but do not execute it yet. "size" is only used when allocating a new
+		// stack.
+		Stack(Create mode, size_t size = Stack_Size::default_size);
 
 		// Destroy.
 		~Stack();
@@ -47,10 +52,70 @@ namespace effects {
 			return p >= start && p < (start + stack_size);
 		}
 
+		// Start of the stack. Null for the original stack of a thread.
+		void *base() const {
+			return stack_base;
+		}
+
+		// Size of the stack.
+		size_t size() const {
+			return stack_size;
+		}
+
+		// Saved stack pointer. Only meaningful when the stack is not executing.
+		void *stack_pointer() const {
+			return reinterpret_cast<void *>(context.stack_pointer());
+		}
+
+		// Update the high-water mark from the saved stack pointer. Only meaningful when the stack
+		// is not executing.
+		void update_high_water() {
+			note_used(used());
+		}
+
+		// Note that the topmost "bytes" of the stack have been used.
+		void note_used(size_t bytes) {
+			if (bytes > max_used)
+				max_used = bytes;
+			if (bytes > dirty)
+				dirty = bytes;
+		}
+
+		// Number of bytes used, according to the saved stack pointer. Only meaningful when the
+		// stack is not executing.
+		size_t used() const {
+			return reinterpret_cast<size_t>(stack_base) + stack_size - context.stack_pointer();
+		}
+
+		// Return pages below the saved stack pointer to the OS if enough of them are known to have
+		// been used. Only meaningful when the stack is not executing.
+		void release_unused();
+
+		// Return all pages of the stack to the OS immediately, so that "touched" only reports pages
+		// that are touched afterwards. Only valid before the stack is started.
+		void release_all();
+
+		// Highest number of bytes observed to be in use when the stack was suspended.
+		size_t high_water() const {
+			return max_used;
+		}
+
+		// Number of bytes from the top of the stack to the lowest page that is resident in
+		// memory. Gives an upper bound of the stack usage since the pages were last released.
+		// Requires a system call.
+		size_t touched() const;
+
+		// Number of bytes of the stack that are resident in memory. Requires a system call.
+		size_t resident() const;
+
+		// Memory used by the stacks allocated by the current thread that are in use, including
+		// those that are now used by other threads.
+		static Stack_Memory_Usage live_usage();
+
 	private:
 		// The context that this stack represents. When the stack is currently being executed, the
 		// contents of this member might not be reliable.
-		ucontext_t context;
+		Context context;
 
 		// Pointer to the start of the allocated stack. Might be null.
 		void *stack_base;
@@ -58,6 +123,23 @@ namespace effects {
 		// Size of the allocated stack.
 		size_t stack_size;
 
+		// High-water mark.
+		size_t max_used;
+
+		// Number of bytes at the top of the stack that are known to have been used since we last
+		// released memory to the OS. Usage is only observed when the stack is suspended, so the
+		// stack may have been used deeper than this.
+		size_t dirty;
+
+		// List of stacks allocated by the thread that allocated this stack, and the previous and
+		// next stacks in it, to keep track of memory usage.
+		Live_Stacks *live;
+		Stack *prev_live;
+		Stack *next_live;
+
+		// Pages of copy-on-write snapshots mapped onto the stack.
+		Stack_Mapping mapping;
+
 		// Friend the mirror to allow save/restore.
 		friend class Stack_Mirror;
 
@@ -76,26 +158,36 @@ namespace effects {
 	class Stack_Mirror {
 	public:
 		// Create.
-		Stack_Mirror(Stack &original, Pointer_Set shared_ptrs, Shared_Ptr<Handler_Frame> handler);
+		Stack_Mirror(Stack &original, Pointer_Set shared_ptrs, Shared_Ptr<Handler_Frame> handler, Handler_Frame *tail_handler);
 
 		// Associated handler frame.
 		Shared_Ptr<Handler_Frame> handler;
 
+		// Tail-resumptive handler that was executing on the stack, if any.
+		Handler_Frame *tail_handler;
+
 		// Pointers stored on the stack.
 		Pointer_Set shared_ptrs;
 
 		// Restore.
 		void restore() const;
 
+		// Number of bytes copied.
+		size_t bytes() const {
+			return stack_copy.size();
+		}
+
 	private:
-		// Copy of the ucontext.
-		ucontext_t context;
+		// Copy of the context.
+		Context context;
 
 		// Contents of the stack.
-		std::vector<char> stack_copy;
+		Stack_Snapshot stack_copy;
 
+#ifndef EFFECTS_ASM_CONTEXT
 		// Copy of the machine state, if not included in "context" above on this particular platform.
-		std::vector<char> state_copy;
+		Byte_Buffer state_copy;
+#endif
 
 		// Stack we originally copied from, so that we can restore to it.
 		Stack *original;
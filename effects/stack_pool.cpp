@@ -0,0 +1,417 @@
+#include "stack_pool.h"
+#include "config.h"
+#include "stats.h"
+#include "debug.h"
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <new>
+
+namespace effects {
+
+	// Get the current page size.
+	static size_t page_size() {
+		static size_t sz = 0;
+		if (sz == 0) {
+			int s = getpagesize();
+			sz = static_cast<size_t>(s);
+		}
+		return sz;
+	}
+
+	// Number of size classes. Class N contains stacks of 2^N pages.
+	static const size_t size_classes = 8 * sizeof(size_t);
+
+	// Smallest size class we allocate.
+	static size_t min_class() {
+		static size_t c = 0;
+		if (c == 0) {
+			while ((page_size() << c) < Stack_Size::min_size)
+				c++;
+		}
+		return c;
+	}
+
+	// Find the size class for a size.
+	static size_t size_class(size_t size) {
+		size_t page_size = effects::page_size();
+		size_t pages = (size + page_size - 1) / page_size;
+		size_t c = min_class();
+		while ((size_t(1) << c) < pages)
+			c++;
+		return c;
+	}
+
+	// Size of stacks in a size class.
+	static size_t class_size(size_t size_class) {
+		return page_size() << size_class;
+	}
+
+	// Current configuration.
+	static std::atomic<size_t> config_prewarm = 0;
+	static std::atomic<size_t> config_max_free = 64;
+	static std::atomic<size_t> config_slab_size = 64 * 1024 * 1024;
+	static std::atomic<bool> config_huge_pages = false;
+	static std::atomic<size_t> config_release_threshold = 64 * 1024;
+	static std::atomic<bool> config_lazy_release = true;
+
+
+	/**
+	 * Node in a list of free stacks. Stored at the top of each free stack, since these pages are
+	 * almost certainly resident already.
+	 */
+	struct Free_Stack {
+		Free_Stack *next;
+		Stack_Memory memory;
+
+		// Add a stack to a list.
+		static void push(Free_Stack *&first, Stack_Memory memory) {
+			char *top = static_cast<char *>(memory.base) + memory.size;
+			first = new (top - sizeof(Free_Stack)) Free_Stack{first, memory};
+		}
+
+		// Remove a stack from a list. Returns an empty Stack_Memory if the list is empty.
+		static Stack_Memory pop(Free_Stack *&first) {
+			Free_Stack *node = first;
+			if (!node)
+				return Stack_Memory();
+
+			first = node->next;
+			return node->memory;
+		}
+	};
+
+
+	/**
+	 * Slabs.
+	 *
+	 * Stacks are carved out of large reservations, so that many stacks share a single mapping.
+	 * Guard pages are installed using MADV_GUARD_INSTALL where it is supported, which does not
+	 * split the mapping. Otherwise, we fall back to mprotect, which costs two mappings per stack.
+	 * The number of stacks is then limited by vm.max_map_count (a little over 32000 stacks with
+	 * the default limit), and allocating a stack fails with std::bad_alloc when the limit is hit.
+	 *
+	 * Slabs are shared between all threads, and are never returned to the OS. The memory of stacks
+	 * released to a slab is, however.
+	 */
+
+#if defined(__linux__) && !defined(MADV_GUARD_INSTALL)
+#define MADV_GUARD_INSTALL 102
+#endif
+
+	// Can we use MADV_GUARD_INSTALL?
+	static std::atomic<bool> lightweight_guards = true;
+
+	// Make a page into a guard page. Throws std::bad_alloc on failure.
+	static void install_guard(void *page) {
+#if defined(__linux__)
+		if (lightweight_guards.load(std::memory_order_relaxed)) {
+			if (madvise(page, page_size(), MADV_GUARD_INSTALL) == 0)
+				return;
+			lightweight_guards.store(false, std::memory_order_relaxed);
+		}
+#endif
+		if (mprotect(page, page_size(), PROT_NONE) != 0)
+			throw std::bad_alloc();
+	}
+
+	/**
+	 * Stacks of one size class.
+	 */
+	struct Slab_Class {
+		// Lock for this class.
+		std::mutex lock;
+
+		// Released stacks.
+		Free_Stack *free = nullptr;
+
+		// Part of the newest slab that has not yet been used.
+		char *next = nullptr;
+		char *end = nullptr;
+	};
+
+	// All size classes.
+	static Slab_Class slab_classes[size_classes];
+
+	// Allocate a new slab for a size class. Assumes the lock is held.
+	static void new_slab(Slab_Class &slab, size_t size_class) {
+		size_t slot_size = class_size(size_class) + page_size(); // Guard page.
+		size_t slots = config_slab_size.load(std::memory_order_relaxed) / slot_size;
+		if (slots < 16)
+			slots = 16;
+
+		size_t size = slots * slot_size;
+		void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+							MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (memory == MAP_FAILED)
+			throw std::bad_alloc();
+
+#if defined(MADV_HUGEPAGE)
+		if (config_huge_pages.load(std::memory_order_relaxed))
+			madvise(memory, size, MADV_HUGEPAGE);
+#endif
+
+		slab.next = static_cast<char *>(memory);
+		slab.end = slab.next + size;
+	}
+
+	// Get a stack from the slabs.
+	static Stack_Memory slab_allocate(size_t size_class) {
+		Slab_Class &slab = slab_classes[size_class];
+		std::lock_guard<std::mutex> guard(slab.lock);
+
+		Stack_Memory result = Free_Stack::pop(slab.free);
+		if (result.base) {
+			count(stat_stacks_mapped);
+			return result;
+		}
+
+		if (slab.next == slab.end)
+			new_slab(slab, size_class);
+
+		install_guard(slab.next);
+		result.base = slab.next + page_size();
+		result.size = class_size(size_class);
+		slab.next += result.size + page_size();
+		count(stat_stacks_mapped);
+		return result;
+	}
+
+	// Return a stack to the slabs, and its memory to the OS.
+	static void slab_release(Stack_Memory memory) {
+		// Keep the topmost page, we store the free list there.
+		madvise(memory.base, memory.size - page_size(), MADV_DONTNEED);
+
+		Slab_Class &slab = slab_classes[size_class(memory.size)];
+		std::lock_guard<std::mutex> guard(slab.lock);
+		Free_Stack::push(slab.free, memory);
+	}
+
+
+	/**
+	 * Free lists of stacks for a single thread.
+	 */
+	class Thread_Stack_Pool {
+	public:
+		// Destroy, returns all stacks to the slabs.
+		~Thread_Stack_Pool();
+
+		// Has this pool been pre-warmed?
+		bool warm = false;
+
+		// Number of stacks in each size class.
+		size_t count[size_classes] = {};
+
+		// Total number of stacks.
+		size_t total = 0;
+
+		// Add a stack.
+		void push(size_t size_class, Stack_Memory memory);
+
+		// Remove a stack. Returns an empty Stack_Memory if there are no stacks of the desired size.
+		Stack_Memory pop(size_t size_class);
+
+		// Remove all stacks.
+		void clear();
+
+		// Call "fn" for all stacks.
+		template <typename Fn>
+		void each(Fn fn) {
+			for (size_t i = 0; i < size_classes; i++)
+				for (Free_Stack *at = first[i]; at; at = at->next)
+					fn(at->memory);
+		}
+
+	private:
+		// First node in each list.
+		Free_Stack *first[size_classes] = {};
+	};
+
+	// The pool for this thread.
+	static EFFECTS_THREAD_LOCAL Thread_Stack_Pool thread_pool;
+
+	// Set when "thread_pool" has been destroyed. Stacks released after this point (e.g. from other
+	// thread_local destructors) are returned directly to the slabs.
+	static EFFECTS_THREAD_LOCAL bool thread_pool_dead = false;
+
+	Thread_Stack_Pool::~Thread_Stack_Pool() {
+		clear();
+		thread_pool_dead = true;
+	}
+
+	void Thread_Stack_Pool::push(size_t size_class, Stack_Memory memory) {
+		Free_Stack::push(first[size_class], memory);
+		count[size_class]++;
+		total++;
+	}
+
+	Stack_Memory Thread_Stack_Pool::pop(size_t size_class) {
+		Stack_Memory result = Free_Stack::pop(first[size_class]);
+		if (result.base) {
+			count[size_class]--;
+			total--;
+		}
+		return result;
+	}
+
+	void Thread_Stack_Pool::clear() {
+		for (size_t i = 0; i < size_classes; i++)
+			while (count[i] > 0)
+				slab_release(pop(i));
+	}
+
+
+	Stack_Memory Stack_Pool::allocate(size_t size) {
+		size_t c = size_class(size);
+		if (thread_pool_dead)
+			return slab_allocate(c);
+
+		if (!thread_pool.warm) {
+			thread_pool.warm = true;
+			prewarm(config_prewarm.load(std::memory_order_relaxed));
+		}
+
+		Stack_Memory memory = thread_pool.pop(c);
+		if (!memory.base)
+			memory = slab_allocate(c);
+		return memory;
+	}
+
+	void Stack_Pool::release(Stack_Memory memory) {
+		if (!memory.base)
+			return;
+
+		size_t c = size_class(memory.size);
+		if (thread_pool_dead || thread_pool.count[c] >= config_max_free.load(std::memory_order_relaxed)) {
+			slab_release(memory);
+			return;
+		}
+
+		// The stack pointer is only observed when the stack is suspended, so frames that ran to
+		// completion may have used more of the stack than we know of. Discarding pages that were
+		// never touched is cheap, so we discard everything.
+		char *top = static_cast<char *>(memory.base) + memory.size;
+		discard(memory.base, top - std::min(release_threshold(), memory.size));
+
+		thread_pool.push(c, memory);
+	}
+
+	void Stack_Pool::discard(void *begin, void *end, bool allow_lazy) {
+		size_t page_size = effects::page_size();
+		size_t from = (reinterpret_cast<size_t>(begin) + page_size - 1) & ~(page_size - 1);
+		size_t to = reinterpret_cast<size_t>(end) & ~(page_size - 1);
+		if (from >= to)
+			return;
+
+		void *start = reinterpret_cast<void *>(from);
+#if defined(MADV_FREE)
+		if (allow_lazy && config_lazy_release.load(std::memory_order_relaxed))
+			if (madvise(start, to - from, MADV_FREE) == 0)
+				return;
+#endif
+		madvise(start, to - from, MADV_DONTNEED);
+	}
+
+	void Stack_Pool::release_memory() {
+		if (thread_pool_dead)
+			return;
+
+		thread_pool.each([](Stack_Memory memory) {
+			char *top = static_cast<char *>(memory.base) + memory.size;
+			discard(memory.base, top - page_size());
+		});
+	}
+
+	Stack_Memory_Usage Stack_Pool::usage() {
+		Stack_Memory_Usage result;
+		if (thread_pool_dead)
+			return result;
+
+		thread_pool.each([&result](Stack_Memory memory) {
+			result.count++;
+			result.reserved += memory.size;
+			result.resident += resident(memory.base, static_cast<char *>(memory.base) + memory.size);
+		});
+		return result;
+	}
+
+	size_t Stack_Pool::resident(void *begin, void *end) {
+		size_t page_size = effects::page_size();
+		size_t from = reinterpret_cast<size_t>(begin) & ~(page_size - 1);
+		size_t to = reinterpret_cast<size_t>(end);
+
+		const size_t chunk = 64;
+#if defined(__APPLE__)
+		char pages[chunk];
+#else
+		unsigned char pages[chunk];
+#endif
+
+		size_t result = 0;
+		while (from < to) {
+			size_t count = std::min(chunk, (to - from + page_size - 1) / page_size);
+			if (mincore(reinterpret_cast<void *>(from), count * page_size, pages) != 0)
+				break;
+
+			for (size_t i = 0; i < count; i++)
+				if (pages[i] & 1)
+					result += page_size;
+			from += count * page_size;
+		}
+		return result;
+	}
+
+	size_t Stack_Pool::release_threshold() {
+		return config_release_threshold.load(std::memory_order_relaxed);
+	}
+
+	void Stack_Pool::prewarm(size_t count, size_t size) {
+		if (thread_pool_dead)
+			return;
+
+		size_t c = size_class(size);
+		thread_pool.warm = true;
+		while (thread_pool.count[c] < count)
+			thread_pool.push(c, slab_allocate(c));
+	}
+
+	void Stack_Pool::clear() {
+		if (thread_pool_dead)
+			return;
+
+		thread_pool.clear();
+	}
+
+	size_t Stack_Pool::free_count() {
+		if (thread_pool_dead)
+			return 0;
+		return thread_pool.total;
+	}
+
+	size_t Stack_Pool::rounded_size(size_t size) {
+		return class_size(size_class(size));
+	}
+
+	Stack_Pool_Config Stack_Pool::config() {
+		Stack_Pool_Config result;
+		result.prewarm = config_prewarm.load(std::memory_order_relaxed);
+		result.max_free = config_max_free.load(std::memory_order_relaxed);
+		result.slab_size = config_slab_size.load(std::memory_order_relaxed);
+		result.huge_pages = config_huge_pages.load(std::memory_order_relaxed);
+		result.release_threshold = config_release_threshold.load(std::memory_order_relaxed);
+		result.lazy_release = config_lazy_release.load(std::memory_order_relaxed);
+		return result;
+	}
+
+	void Stack_Pool::config(const Stack_Pool_Config &config) {
+		config_prewarm.store(config.prewarm, std::memory_order_relaxed);
+		config_max_free.store(config.max_free, std::memory_order_relaxed);
+		config_slab_size.store(config.slab_size, std::memory_order_relaxed);
+		config_huge_pages.store(config.huge_pages, std::memory_order_relaxed);
+		config_release_threshold.store(config.release_threshold, std::memory_order_relaxed);
+		config_lazy_release.store(config.lazy_release, std::memory_order_relaxed);
+	}
+
+}
@@ -0,0 +1,132 @@
+#pragma once
+#include <cstddef>
+#include "stack_size.h"
+
+namespace effects {
+
+	/**
+	 * Allocation of memory for stacks.
+	 *
+	 * Stacks are carved out of large memory reservations (slabs), so that the number of mappings
+	 * does not limit the number of stacks. This requires MADV_GUARD_INSTALL (Linux 6.13) for the
+	 * guard pages. On other systems, each guard page splits the slab, and the number of stacks is
+	 * limited by the maximum number of mappings of the process.
+	 *
+	 * Taking a stack from a slab requires a lock and a system call for the guard page, which is
+	 * expensive compared to the rest of a call to handle(). For this reason, released stacks are
+	 * kept in a per-thread free list and reused by subsequent allocations on the same thread.
+	 * Stacks released beyond that are returned to the slabs, and their memory is returned to the
+	 * OS.
+	 *
+	 * Stack sizes are rounded up to a power of two number of pages, and each size has its own free
+	 * list.
+	 */
+
+
+	/**
+	 * Memory for a single stack. The guard page is located just below "base".
+	 */
+	struct Stack_Memory {
+		// Lowest address of the usable part of the stack. Null if no memory is allocated.
+		void *base = nullptr;
+
+		// Size of the usable part of the stack, excluding the guard page.
+		size_t size = 0;
+	};
+
+
+	/**
+	 * Memory used by a set of stacks.
+	 */
+	struct Stack_Memory_Usage {
+		// Number of stacks.
+		size_t count = 0;
+
+		// Address space reserved for the stacks, excluding guard pages.
+		size_t reserved = 0;
+
+		// Memory that is resident. Pages released lazily are counted until the OS reclaims them.
+		size_t resident = 0;
+	};
+
+
+	/**
+	 * Configuration of the stack pools. Applies to all threads.
+	 */
+	struct Stack_Pool_Config {
+		// Number of stacks of the default size to allocate the first time a thread allocates a
+		// stack.
+		size_t prewarm = 0;
+
+		// Maximum number of unused stacks of each size to keep in each thread's pool. Stacks
+		// released beyond this are returned to the slabs.
+		size_t max_free = 64;
+
+		// Approximate size of each slab. Slabs contain at least 16 stacks.
+		size_t slab_size = 64 * 1024 * 1024;
+
+		// Ask for slabs to be backed by transparent huge pages.
+		bool huge_pages = false;
+
+		// Pages of a stack that have been used but are no longer in use are returned to the OS when
+		// they amount to at least this many bytes. This applies to suspended stacks (the pages
+		// below the stack pointer), and to stacks returned to the pool (all but the topmost
+		// "release_threshold" bytes).
+		size_t release_threshold = 64 * 1024;
+
+		// Release pages lazily (MADV_FREE) rather than immediately (MADV_DONTNEED). Lazily released
+		// pages are cheaper to reuse, but are counted as resident until the OS needs the memory.
+		bool lazy_release = true;
+	};
+
+
+	/**
+	 * Per-thread pool of stacks.
+	 */
+	class Stack_Pool {
+	public:
+		// Allocate a stack of at least "size" bytes. Reuses a stack from the current thread's pool
+		// if possible. Throws std::bad_alloc on failure.
+		static Stack_Memory allocate(size_t size);
+
+		// Release a stack to the pool of the current thread. How deep the stack was used is not
+		// known, so all but its topmost "release_threshold" bytes are returned to the OS.
+		static void release(Stack_Memory memory);
+
+		// Return the pages in the range [begin, end) to the OS, as specified by the configuration.
+		// If "allow_lazy" is false, the pages are released immediately regardless of the
+		// configuration. Only pages entirely inside the range are affected.
+		static void discard(void *begin, void *end, bool allow_lazy = true);
+
+		// Return the memory of all unused stacks in the pool of the current thread to the OS,
+		// except for their topmost page. Suitable to call when a thread is idle.
+		static void release_memory();
+
+		// Memory used by the unused stacks in the pool of the current thread. Requires system calls.
+		static Stack_Memory_Usage usage();
+
+		// Number of resident bytes in the range [begin, end). Requires a system call.
+		static size_t resident(void *begin, void *end);
+
+		// Current release threshold.
+		static size_t release_threshold();
+
+		// Make sure that at least "count" stacks of "size" bytes are available in the pool of the
+		// current thread. Intended to be called when a thread starts.
+		static void prewarm(size_t count, size_t size = Stack_Size::default_size);
+
+		// Return all unused stacks in the pool of the current thread to the slabs.
+		static void clear();
+
+		// Number of unused stacks in the pool of the current thread.
+		static size_t free_count();
+
+		// Size of the stacks allocated for a request of "size" bytes.
+		static size_t rounded_size(size_t size);
+
+		// Get/set the configuration.
+		static Stack_Pool_Config config();
+		static void config(const Stack_Pool_Config &config);
+	};
+
+}
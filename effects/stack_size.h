@@ -0,0 +1,117 @@
+#pragma once
+#include <cstddef>
+#include <atomic>
+#include <memory>
+
+namespace effects {
+
+	/**
+	 * Describes how large stacks to allocate for a handler.
+	 *
+	 * The size is either fixed, or adaptive. An adaptive size tracks the highest stack usage
+	 * observed by frames created for the handler, and sizes new stacks to a multiple of that.
+	 * Stack usage is observed whenever a frame is suspended. In addition, every 16th frame starts
+	 * with all pages of its stack released, and inspects which pages it touched when it is
+	 * destroyed, to catch usage that was not visible when it was suspended.
+	 *
+	 * Copies of an adaptive Stack_Size share their observations.
+	 *
+	 * Note: Observations are made after the fact, so a handled body that suddenly uses much more
+	 * stack than before may overflow its stack. The minimum size should therefore be large enough
+	 * for the worst case that is not covered by the observations.
+	 */
+	class Stack_Size {
+	public:
+		// Default size of a stack.
+		static const size_t default_size = 1 * 1024 * 1024; // 1 MiB
+
+		// Smallest stack size we allocate.
+		static const size_t min_size = 8 * 1024; // 8 kiB
+
+		// Create, use the default size.
+		Stack_Size() : fixed(default_size) {}
+
+		// Create, use a fixed size. Rounded up to a power of two number of pages by the allocator.
+		explicit Stack_Size(size_t bytes) : fixed(bytes) {}
+
+		// Create an adaptive size. Stacks are "headroom" times larger than the largest usage
+		// observed so far, but always in the range [min, max]. Until something has been observed,
+		// "max" is used.
+		static Stack_Size adaptive(size_t min = min_size, size_t max = default_size, size_t headroom = 2) {
+			Stack_Size result(max);
+			result.usage = std::make_shared<Usage>(min, max, headroom);
+			return result;
+		}
+
+		/**
+		 * Observed usage for adaptive sizes.
+		 */
+		class Usage {
+		public:
+			// Create.
+			Usage(size_t min, size_t max, size_t headroom) : min(min), max(max), headroom(headroom) {}
+
+			// Bounds and headroom.
+			const size_t min;
+			const size_t max;
+			const size_t headroom;
+
+			// Highest number of bytes observed to be used.
+			std::atomic<size_t> high_water = 0;
+
+			// Number of created frames. Used to sample usage periodically.
+			std::atomic<size_t> frames = 0;
+
+			// Should a new frame sample which pages it touches?
+			bool sample() {
+				return frames.fetch_add(1, std::memory_order_relaxed) % 16 == 0;
+			}
+
+			// Record an observation.
+			void observe(size_t used) {
+				size_t old = high_water.load(std::memory_order_relaxed);
+				while (used > old && !high_water.compare_exchange_weak(old, used, std::memory_order_relaxed))
+					;
+			}
+
+			// Size to allocate.
+			size_t bytes() const {
+				size_t used = high_water.load(std::memory_order_relaxed);
+				if (used == 0)
+					return max;
+				size_t want = used * headroom;
+				if (want < min)
+					return min;
+				if (want > max)
+					return max;
+				return want;
+			}
+		};
+
+		// Size of the next stack to allocate.
+		size_t bytes() const {
+			if (usage)
+				return usage->bytes();
+			return fixed;
+		}
+
+		// Is this an adaptive size?
+		bool is_adaptive() const {
+			return usage != nullptr;
+		}
+
+		// Get the usage information. Null if the size is fixed. Frames keep a reference, since
+		// they may outlive the Stack_Size.
+		const std::shared_ptr<Usage> &observed() const {
+			return usage;
+		}
+
+	private:
+		// Fixed size, if not adaptive.
+		size_t fixed;
+
+		// Observations for adaptive sizes.
+		std::shared_ptr<Usage> usage;
+	};
+
+}
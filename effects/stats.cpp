@@ -0,0 +1,109 @@
+#include "stats.h"
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+namespace effects {
+
+#ifndef EFFECTS_NO_STATS
+
+	EFFECTS_FAST_THREAD_LOCAL Stat_Counters stat_counters;
+
+	// Convert counters to Stats.
+	static Stats to_stats(const size_t *values) {
+		Stats s;
+		s.effects_performed = values[stat_effects_performed];
+		s.frames_created = values[stat_frames_created];
+		s.stacks_mapped = values[stat_stacks_mapped];
+		s.stacks_live = values[stat_stacks_live];
+		s.context_switches = values[stat_context_switches];
+		s.continuations_captured = values[stat_continuations_captured];
+		s.continuations_resumed = values[stat_continuations_resumed];
+		s.bytes_captured = values[stat_bytes_captured];
+		s.bytes_restored = values[stat_bytes_restored];
+		s.pointer_set_entries = values[stat_pointer_set_entries];
+		s.pages_mapped = values[stat_pages_mapped];
+		s.pages_shared = values[stat_pages_shared];
+		return s;
+	}
+
+	// Add the counters in "from" to "to".
+	static void add_counters(size_t *to, const Stat_Counters &from) {
+		for (size_t i = 0; i < stat_counter_count; i++)
+			to[i] += from.values[i].load(std::memory_order_relaxed);
+	}
+
+#ifndef EFFECTS_SINGLE_THREADED
+
+	// Lock for the variables below.
+	static std::mutex registry_lock;
+
+	// Counters of all registered threads that are running.
+	static std::vector<Stat_Counters *> registry;
+
+	// Sum of the counters of threads that have exited.
+	static size_t retired[stat_counter_count];
+
+	/**
+	 * Registers the counters of a thread while it is alive.
+	 */
+	struct Stat_Registration {
+		Stat_Registration() {
+			std::lock_guard<std::mutex> guard(registry_lock);
+			registry.push_back(&stat_counters);
+		}
+
+		~Stat_Registration() {
+			std::lock_guard<std::mutex> guard(registry_lock);
+			add_counters(retired, stat_counters);
+			registry.erase(std::find(registry.begin(), registry.end(), &stat_counters));
+		}
+	};
+
+	void register_thread_stats() {
+		static thread_local Stat_Registration registration;
+		(void)registration;
+	}
+
+	Stats stats() {
+		size_t values[stat_counter_count];
+
+		std::lock_guard<std::mutex> guard(registry_lock);
+		std::copy(retired, retired + stat_counter_count, values);
+		for (const Stat_Counters *c : registry)
+			add_counters(values, *c);
+
+		return to_stats(values);
+	}
+
+#else
+
+	void register_thread_stats() {}
+
+	Stats stats() {
+		return thread_stats();
+	}
+
+#endif
+
+	Stats thread_stats() {
+		size_t values[stat_counter_count] = {};
+		add_counters(values, stat_counters);
+		return to_stats(values);
+	}
+
+#else
+
+	void register_thread_stats() {}
+
+	Stats stats() {
+		return Stats();
+	}
+
+	Stats thread_stats() {
+		return Stats();
+	}
+
+#endif
+
+}
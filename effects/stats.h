@@ -0,0 +1,114 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include "config.h"
+
+namespace effects {
+
+	/**
+	 * Counters of what the library is doing.
+	 *
+	 * Each thread increments its own counters, so counting is cheap: there are no locked
+	 * instructions or shared cache lines involved. The counters of a thread are included in
+	 * "stats" from the time it first calls handle(), and remain included after the thread exits.
+	 *
+	 * Define EFFECTS_NO_STATS to compile out the counters entirely. "stats" then returns zeros.
+	 */
+	struct Stats {
+		// Number of effects performed.
+		size_t effects_performed = 0;
+
+		// Number of handler frames created.
+		size_t frames_created = 0;
+
+		// Number of stacks taken from the slabs rather than from the pool of a thread.
+		size_t stacks_mapped = 0;
+
+		// Number of stacks that are currently allocated (by any frame).
+		size_t stacks_live = 0;
+
+		// Number of switches between stacks.
+		size_t context_switches = 0;
+
+		// Number of continuations captured and resumed.
+		size_t continuations_captured = 0;
+		size_t continuations_resumed = 0;
+
+		// Number of bytes of stacks copied when capturing and restoring multi-shot continuations.
+		// Bytes that already had the right contents when restoring are not counted.
+		size_t bytes_captured = 0;
+		size_t bytes_restored = 0;
+
+		// Number of Shared_Ptrs saved in captured continuations.
+		size_t pointer_set_entries = 0;
+
+		// Number of pages of copy-on-write snapshots mapped onto stacks.
+		size_t pages_mapped = 0;
+
+		// Number of pages of snapshots that were identical to a stored page, and shared with it
+		// rather than stored again.
+		size_t pages_shared = 0;
+	};
+
+	// Get the counters, summed over all threads.
+	Stats stats();
+
+	// Get the counters of the current thread.
+	Stats thread_stats();
+
+
+	// Individual counters. In the same order as in Stats.
+	enum Stat_Counter {
+		stat_effects_performed,
+		stat_frames_created,
+		stat_stacks_mapped,
+		stat_stacks_live,
+		stat_context_switches,
+		stat_continuations_captured,
+		stat_continuations_resumed,
+		stat_bytes_captured,
+		stat_bytes_restored,
+		stat_pointer_set_entries,
+		stat_pages_mapped,
+		stat_pages_shared,
+		stat_counter_count
+	};
+
+	/**
+	 * Storage of the counters of a thread. Only modified by the owning thread, but read by other
+	 * threads, hence the atomics. Trivial to construct, so that accessing it does not involve
+	 * checking if it is initialized.
+	 */
+	struct Stat_Counters {
+		std::atomic<size_t> values[stat_counter_count];
+	};
+
+#ifndef EFFECTS_NO_STATS
+
+	// Counters of the current thread.
+	extern EFFECTS_FAST_THREAD_LOCAL Stat_Counters stat_counters;
+
+	// Add to a counter.
+	inline void count(Stat_Counter counter, size_t amount = 1) {
+		std::atomic<size_t> &value = stat_counters.values[counter];
+		value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+	}
+
+	// Subtract from a counter.
+	inline void count_down(Stat_Counter counter, size_t amount = 1) {
+		std::atomic<size_t> &value = stat_counters.values[counter];
+		value.store(value.load(std::memory_order_relaxed) - amount, std::memory_order_relaxed);
+	}
+
+#else
+
+	inline void count(Stat_Counter, size_t = 1) {}
+	inline void count_down(Stat_Counter, size_t = 1) {}
+
+#endif
+
+	// Make the counters of the current thread visible to "stats". Called when the first handler
+	// frame is created on a thread.
+	void register_thread_stats();
+
+}
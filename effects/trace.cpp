@@ -0,0 +1,207 @@
+#include "trace.h"
+#include "effect.h"
+#include "config.h"
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <memory>
+
+namespace effects {
+
+	std::atomic<bool> trace_active = false;
+
+	// Number of spans started.
+	static std::atomic<size_t> trace_spans = 0;
+
+	// Capacity of new buffers.
+	static std::atomic<size_t> trace_capacity = 64 * 1024;
+
+	// Time of an event, in nanoseconds.
+	static uint64_t trace_now() {
+		using namespace std::chrono;
+		return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+	}
+
+	/**
+	 * An event in a buffer. The fields are atomic since they may be read by "trace_flush" while
+	 * the owning thread overwrites them. "index" works as a sequence lock: it is cleared while
+	 * the slot is being written, and then set to the index of the event plus one.
+	 */
+	struct Trace_Slot {
+		std::atomic<size_t> index;
+		std::atomic<uint64_t> time;
+		std::atomic<size_t> event;
+		std::atomic<size_t> id;
+		std::atomic<size_t> value;
+	};
+
+	/**
+	 * Ring buffer for a single thread. Buffers are kept until the program exits, so that events
+	 * recorded by threads that have exited can be flushed.
+	 */
+	class Trace_Buffer {
+	public:
+		Trace_Buffer(size_t capacity, size_t thread) : slots(new Trace_Slot[capacity]()), capacity(capacity), thread(thread) {}
+
+		// The events.
+		std::unique_ptr<Trace_Slot[]> slots;
+		const size_t capacity;
+
+		// Thread ID in the trace.
+		const size_t thread;
+
+		// Number of events written. Only modified by the owning thread.
+		std::atomic<size_t> head = 0;
+
+		// Number of events flushed. Only accessed with "buffers_lock" held.
+		size_t flushed = 0;
+
+		// Add an event.
+		void record(Trace_Event event, size_t id, size_t value) {
+			size_t index = head.load(std::memory_order_relaxed);
+			Trace_Slot &slot = slots[index % capacity];
+
+			slot.index.store(0, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			slot.time.store(trace_now(), std::memory_order_relaxed);
+			slot.event.store(event, std::memory_order_relaxed);
+			slot.id.store(id, std::memory_order_relaxed);
+			slot.value.store(value, std::memory_order_relaxed);
+			slot.index.store(index + 1, std::memory_order_release);
+
+			head.store(index + 1, std::memory_order_release);
+		}
+	};
+
+	// All buffers.
+	static std::mutex buffers_lock;
+	static std::vector<std::unique_ptr<Trace_Buffer>> buffers;
+
+	// Buffer of the current thread.
+	static EFFECTS_FAST_THREAD_LOCAL Trace_Buffer *thread_buffer = nullptr;
+
+	void trace_start(size_t capacity) {
+		if (capacity > 0)
+			trace_capacity.store(capacity, std::memory_order_relaxed);
+		trace_active.store(true, std::memory_order_relaxed);
+	}
+
+	void trace_stop() {
+		trace_active.store(false, std::memory_order_relaxed);
+	}
+
+	void trace_record(Trace_Event event, size_t id, size_t value) {
+		Trace_Buffer *buffer = thread_buffer;
+		if (!buffer) {
+			std::lock_guard<std::mutex> guard(buffers_lock);
+			buffers.push_back(std::make_unique<Trace_Buffer>(trace_capacity.load(std::memory_order_relaxed), buffers.size() + 1));
+			buffer = thread_buffer = buffers.back().get();
+		}
+		buffer->record(event, id, value);
+	}
+
+	size_t trace_begin(Trace_Event event, size_t id) {
+		size_t span = trace_spans.fetch_add(1, std::memory_order_relaxed) + 1;
+		trace_record(event, id, span);
+		return span;
+	}
+
+	// Output the name of an effect as a JSON string.
+	static void write_effect(std::ostream &to, size_t id) {
+		const char *name = effect_name(id);
+		if (name) {
+			to << '"';
+			for (const char *at = name; *at; at++) {
+				if (*at == '"' || *at == '\\')
+					to << '\\';
+				to << *at;
+			}
+			to << '"';
+		} else {
+			to << "\"effect 0x" << std::hex << id << std::dec << '"';
+		}
+	}
+
+	// Output an event.
+	static void write_event(std::ostream &to, size_t thread, uint64_t time, size_t event, size_t id, size_t value) {
+		to << "{\"pid\": 1, \"tid\": " << thread << ", \"ts\": " << (time / 1000) << '.';
+		to << char('0' + (time / 100) % 10) << char('0' + (time / 10) % 10) << char('0' + time % 10);
+
+		switch (event) {
+		case trace_handle_enter:
+			to << ", \"ph\": \"b\", \"cat\": \"handle\", \"name\": \"handle\", \"id\": " << value;
+			break;
+		case trace_handle_exit:
+			to << ", \"ph\": \"e\", \"cat\": \"handle\", \"name\": \"handle\", \"id\": " << value;
+			break;
+		case trace_perform:
+			to << ", \"ph\": \"i\", \"s\": \"t\", \"cat\": \"perform\", \"name\": ";
+			write_effect(to, id);
+			break;
+		case trace_clause_enter:
+			to << ", \"ph\": \"b\", \"cat\": \"clause\", \"name\": ";
+			write_effect(to, id);
+			to << ", \"id\": " << value;
+			break;
+		case trace_clause_exit:
+			to << ", \"ph\": \"e\", \"cat\": \"clause\", \"name\": ";
+			write_effect(to, id);
+			to << ", \"id\": " << value;
+			break;
+		case trace_capture:
+			to << ", \"ph\": \"i\", \"s\": \"t\", \"name\": \"capture\", \"args\": {\"frames\": " << id
+			   << ", \"bytes\": " << value << "}";
+			break;
+		case trace_resume:
+			to << ", \"ph\": \"i\", \"s\": \"t\", \"name\": \"resume\", \"args\": {\"frames\": " << id << "}";
+			break;
+		case trace_relink:
+			to << ", \"ph\": \"i\", \"s\": \"t\", \"name\": \"relink\", \"args\": {\"frames\": " << id
+			   << ", \"moved\": " << (value ? "true" : "false") << "}";
+			break;
+		}
+
+		to << "}";
+	}
+
+	void trace_flush(std::ostream &to) {
+		std::lock_guard<std::mutex> guard(buffers_lock);
+
+		to << "{\"traceEvents\": [";
+		bool first = true;
+
+		for (const std::unique_ptr<Trace_Buffer> &buffer : buffers) {
+			size_t head = buffer->head.load(std::memory_order_acquire);
+			size_t from = buffer->flushed;
+			if (head - from > buffer->capacity)
+				from = head - buffer->capacity;
+
+			for (size_t i = from; i < head; i++) {
+				Trace_Slot &slot = buffer->slots[i % buffer->capacity];
+				if (slot.index.load(std::memory_order_acquire) != i + 1)
+					continue;
+
+				uint64_t time = slot.time.load(std::memory_order_relaxed);
+				size_t event = slot.event.load(std::memory_order_relaxed);
+				size_t id = slot.id.load(std::memory_order_relaxed);
+				size_t value = slot.value.load(std::memory_order_relaxed);
+
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (slot.index.load(std::memory_order_relaxed) != i + 1)
+					continue;
+
+				if (!first)
+					to << ",";
+				to << "\n";
+				first = false;
+
+				write_event(to, buffer->thread, time, event, id, value);
+			}
+
+			buffer->flushed = head;
+		}
+
+		to << "\n]}\n";
+	}
+
+}
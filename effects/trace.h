@@ -0,0 +1,117 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+namespace effects {
+
+	/**
+	 * Event tracing.
+	 *
+	 * When tracing is started, each thread records timestamped events into its own ring buffer.
+	 * Only the owning thread writes to a buffer, so recording does not take any locks. When a
+	 * buffer is full, the oldest events are overwritten. "trace_flush" writes the recorded events
+	 * of all threads in the Chrome trace event format, which can be opened in chrome://tracing or
+	 * Perfetto.
+	 *
+	 * Handlers and clauses are written as asynchronous spans rather than as begin/end pairs on
+	 * their thread, since switching between stacks means that they do not always nest: a clause
+	 * that resumes its continuation outlives the handlers started by the body before the effect.
+	 *
+	 * When tracing is stopped, recording an event costs a load and a branch. Define
+	 * EFFECTS_NO_TRACE to compile out tracing entirely.
+	 */
+
+	// Types of events.
+	enum Trace_Event {
+		// handle() was called, and returned. "value" identifies the span.
+		trace_handle_enter,
+		trace_handle_exit,
+
+		// An effect was performed. "id" is the effect.
+		trace_perform,
+
+		// A handler clause started and finished executing. "id" is the effect, "value" identifies
+		// the span.
+		trace_clause_enter,
+		trace_clause_exit,
+
+		// A continuation was captured. "id" is the number of frames, "value" the number of
+		// bytes copied.
+		trace_capture,
+
+		// A continuation was resumed. "id" is the number of frames.
+		trace_resume,
+
+		// The frames of a continuation were linked. "id" is the number of frames, "value" is 1 if
+		// the frames were linked to a different place than before.
+		trace_relink,
+	};
+
+	// Start recording events. Each thread's buffer holds "capacity" events. The capacity only
+	// affects buffers created after the call.
+	void trace_start(size_t capacity = 64 * 1024);
+
+	// Stop recording events.
+	void trace_stop();
+
+	// Write all events recorded since the last flush as Chrome trace events (JSON), and discard
+	// them. Events that are overwritten while they are being written are skipped.
+	void trace_flush(std::ostream &to);
+
+	// Record an event. Only for use by the library.
+	void trace_record(Trace_Event event, size_t id, size_t value);
+
+	// Record the start of a span. Returns a value that identifies the span among all threads,
+	// which is never zero. Only for use by the library.
+	size_t trace_begin(Trace_Event event, size_t id);
+
+	// Is tracing active?
+	extern std::atomic<bool> trace_active;
+
+	// Record an event if tracing is active.
+	inline void trace(Trace_Event event, size_t id = 0, size_t value = 0) {
+#ifndef EFFECTS_NO_TRACE
+		if (trace_active.load(std::memory_order_relaxed))
+			trace_record(event, id, value);
+#else
+		(void)event;
+		(void)id;
+		(void)value;
+#endif
+	}
+
+	/**
+	 * Records the start of a span when created and its end when destroyed, so that the end event
+	 * is recorded even if an exception is thrown. The end is only recorded if the start was, so
+	 * that spans are always complete.
+	 */
+	class Trace_Scope {
+	public:
+		Trace_Scope(Trace_Event enter, Trace_Event exit, size_t id = 0) : exit(exit), id(id) {
+#ifndef EFFECTS_NO_TRACE
+			if (trace_active.load(std::memory_order_relaxed))
+				span = trace_begin(enter, id);
+#else
+			(void)enter;
+#endif
+		}
+
+		~Trace_Scope() {
+			if (span)
+				trace_record(exit, id, span);
+		}
+
+		Trace_Scope(const Trace_Scope &) = delete;
+		Trace_Scope &operator =(const Trace_Scope &) = delete;
+
+	private:
+		Trace_Event exit;
+		size_t id;
+
+		// Identifies the span, or zero if the start was not recorded.
+		size_t span = 0;
+	};
+
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include <tuple>
+#include <utility>
 
 namespace effects {
 
@@ -7,7 +8,9 @@ namespace effects {
 	 * General utilities.
 	 */
 
-	// Helper to call a function with parameters in a tuple.
+	// Helper to call a function with parameters in a tuple. The parameters are moved out of the
+	// tuple if it is an rvalue, so that move-only types can be passed, and passed as lvalues
+	// otherwise.
 	template <typename Result, typename Tuple>
 	struct Tuple_Call {
 		template <int N, int... S>
@@ -15,14 +18,14 @@ namespace effects {
 
 		template <int... S>
 		struct Arg_Seq<0, S...> {
-			template <typename Function>
-			static Result call(Function &&fn, const Tuple &args) {
-				return fn(std::get<S>(args)...);
+			template <typename Function, typename Args>
+			static Result call(Function &&fn, Args &&args) {
+				return fn(std::get<S>(std::forward<Args>(args))...);
 			}
 
-			template <typename Function, typename Append>
-			static Result call(Function &&fn, const Tuple &args, Append &&append) {
-				return fn(std::get<S>(args)..., std::forward<Append>(append));
+			template <typename Function, typename Args, typename Append>
+			static Result call(Function &&fn, Args &&args, Append &&append) {
+				return fn(std::get<S>(std::forward<Args>(args))..., std::forward<Append>(append));
 			}
 		};
 
@@ -35,6 +38,31 @@ namespace effects {
 		static Result call(Function &&fn, const Tuple &args, Append &&append) {
 			return Arg_Seq<std::tuple_size<Tuple>::value>::call(fn, args, std::forward<Append>(append));
 		}
+
+		template <typename Function>
+		static Result call(Function &&fn, Tuple &&args) {
+			return Arg_Seq<std::tuple_size<Tuple>::value>::call(fn, std::move(args));
+		}
+
+		template <typename Function, typename Append>
+		static Result call(Function &&fn, Tuple &&args, Append &&append) {
+			return Arg_Seq<std::tuple_size<Tuple>::value>::call(fn, std::move(args), std::forward<Append>(append));
+		}
 	};
 
+	// Unique address for each type. Allows comparing types with an integer comparison.
+	template <typename T>
+	inline constexpr char type_tag = 0;
+
+	// Cast "from" to "To", a reference to its dynamic type. The type is only verified when DEBUG is
+	// defined, otherwise the cast is a static_cast.
+	template <typename To, typename From>
+	To checked_cast(From &from) {
+#ifdef DEBUG
+		return dynamic_cast<To>(from);
+#else
+		return static_cast<To>(from);
+#endif
+	}
+
 }
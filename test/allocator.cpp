@@ -0,0 +1,115 @@
+#include <iostream>
+#include <cstdlib>
+#include <new>
+#include <unordered_set>
+#include "effects/effects.h"
+
+/**
+ * Checks that performing effects and resuming continuations does not allocate memory once the
+ * caches are warm, that the allocator hooks are used, and that only memory from the allocate hook
+ * is passed to the deallocate hook (also after main returns).
+ */
+
+using namespace effects;
+
+// Number of calls to operator new.
+static size_t allocations = 0;
+
+void *operator new(size_t size) {
+	allocations++;
+	if (void *result = std::malloc(size ? size : 1))
+		return result;
+	throw std::bad_alloc();
+}
+
+void operator delete(void *memory) noexcept {
+	std::free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept {
+	std::free(memory);
+}
+
+// Number of calls to the hooks.
+static size_t hook_allocations = 0;
+static size_t hook_deallocations = 0;
+
+// Blocks allocated through the hook. Never destroyed, since blocks are freed after main returns.
+static std::unordered_set<void *> &hook_blocks() {
+	static std::unordered_set<void *> *blocks = new std::unordered_set<void *>();
+	return *blocks;
+}
+
+static void *hook_allocate(size_t size, void *) {
+	hook_allocations++;
+	void *memory = ::operator new(size);
+	hook_blocks().insert(memory);
+	return memory;
+}
+
+static void hook_deallocate(void *memory, size_t, void *) {
+	hook_deallocations++;
+	if (hook_blocks().erase(memory) == 0) {
+		std::cout << "ERROR: Memory not from the allocate hook was freed through the hook." << std::endl;
+		std::_Exit(1);
+	}
+	::operator delete(memory);
+}
+
+Effect<int (int)> tail_effect;
+Effect<int (int)> one_shot_effect;
+Effect<int (int)> multi_shot_effect;
+
+Handler<int, int> handler{
+	{
+		{ tail_effect, [](int x) { return x + 1; } },
+		{ one_shot_effect, [](int x, const One_Shot_Continuation<int, int> &cont) { return cont(x + 1); } },
+		{ multi_shot_effect, [](int x, const Continuation<int, int> &cont) { return cont(x + 1); } }
+	}
+};
+
+// Handle a body that performs "effect" a number of times.
+static int perform(Effect<int (int)> &effect) {
+	return handle(handler, [&effect]() {
+		Shared_Ptr<int> p = mk_shared<int>(1);
+		int x = 0;
+		for (int i = 0; i < 100; i++)
+			x = effect(+x);
+		return x + *p.get();
+	});
+}
+
+// Check that "perform" does not allocate once warmed up.
+static bool check(const char *name, Effect<int (int)> &effect) {
+	perform(effect);
+
+	size_t before = allocations;
+	int result = perform(effect);
+	size_t count = allocations - before;
+
+	std::cout << name << ": " << count << " allocations" << std::endl;
+	return result == 101 && count == 0;
+}
+
+int main() {
+	Allocator_Config config;
+	config.allocate = &hook_allocate;
+	config.deallocate = &hook_deallocate;
+	allocator_config(config);
+
+	bool ok = true;
+	ok &= check("Tail-resumptive", tail_effect);
+	ok &= check("One-shot", one_shot_effect);
+	ok &= check("Multi-shot", multi_shot_effect);
+
+	std::cout << "Hook allocations: " << hook_allocations << std::endl;
+	ok &= hook_allocations > 0;
+
+	// Everything in the cache is returned through the hook.
+	size_t deallocations = hook_deallocations;
+	release_cached_blocks();
+	std::cout << "Hook deallocations: " << (hook_deallocations - deallocations) << std::endl;
+	ok &= hook_deallocations > deallocations;
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,83 @@
+#include <iostream>
+#include <execinfo.h>
+#include "effects/effects.h"
+
+/**
+ * Checks that stack traces from inside handled bodies continue into the code that called
+ * handle(), and the frames reported by handler_frames().
+ */
+
+using namespace effects;
+
+Effect<int (int)> effect;
+
+Handler<int, int> handler{
+	{ effect, [](int x, const Continuation<int, int> &cont) { return cont(x + 1); } }
+};
+
+// Return address in main, of the call to "run".
+static void *in_main = nullptr;
+
+// Found in the backtrace?
+static bool reached_main = false;
+
+// Frames seen.
+static size_t frame_count = 0;
+static bool frames_ok = true;
+
+static void inspect() {
+	void *trace[256];
+	int count = backtrace(trace, 256);
+	for (int i = 0; i < count; i++)
+		reached_main |= trace[i] == in_main;
+
+	Frame_Info frames[8];
+	frame_count = handler_frames(frames, 8);
+	int local = 0;
+	frames_ok &= frame_count >= 1 && frame_count <= 8;
+	for (size_t i = 0; frames_ok && i < frame_count; i++) {
+		char *low = static_cast<char *>(frames[i].stack_base);
+		char *high = low + frames[i].stack_size;
+		char *sp = static_cast<char *>(frames[i].stack_pointer);
+		if (i == 0)
+			frames_ok &= sp == nullptr && low <= reinterpret_cast<char *>(&local) && reinterpret_cast<char *>(&local) < high;
+		else
+			frames_ok &= low <= sp && sp < high;
+	}
+}
+
+__attribute__((noinline)) static int run() {
+	in_main = __builtin_return_address(0);
+
+	return handle(handler, []() {
+		int x = effect(1);
+		return handle(handler, [x]() {
+			int y = effect(+x);
+			inspect();
+			return y;
+		});
+	});
+}
+
+int main() {
+	bool ok = true;
+
+	int result = run();
+	if (result != 3) {
+		std::cout << "Wrong result: " << result << std::endl;
+		ok = false;
+	}
+
+	std::cout << "Frames: " << frame_count << std::endl;
+	if (frame_count != 2 || !frames_ok) {
+		std::cout << "Wrong frames" << std::endl;
+		ok = false;
+	}
+
+#ifdef EFFECTS_ASM_CONTEXT
+	std::cout << "Reached main: " << (reached_main ? "yes" : "no") << std::endl;
+	ok &= reached_main;
+#endif
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,91 @@
+#include <iostream>
+#include <utility>
+#include "effects/effects.h"
+
+/**
+ * Checks that clauses are found in handlers of different sizes, both small ones that are searched
+ * linearly and large ones that are searched with binary search.
+ */
+
+using namespace effects;
+
+const size_t effect_count = 12;
+
+Effect<int (int)> effects_handled[effect_count];
+
+Effect<int (int)> unhandled_effect;
+
+// Handler of the first "sizeof...(I)" effects, added in reverse order. Effect "i" adds 100 * i.
+template <size_t... I>
+static Handler<int, int> make_erased(std::index_sequence<I...>) {
+	constexpr size_t count = sizeof...(I);
+	return Handler<int, int>{
+		{ Handler_Init<int>(effects_handled[count - 1 - I], [](int x) { return x + int(100 * (count - 1 - I)); })... }
+	};
+}
+
+template <size_t... I>
+static auto make_static(std::index_sequence<I...>) {
+	return make_handler<int>(clause(effects_handled[I], [](int x) { return x + int(100 * I); })...);
+}
+
+// Check a condition.
+static bool check(const char *name, size_t count, bool ok) {
+	std::cout << name << " (" << count << " clauses): " << (ok ? "ok" : "failed") << std::endl;
+	return ok;
+}
+
+// Check the table of "handler", which handles the first "count" effects.
+template <typename Handler_Type>
+static bool check_handler(const char *name, size_t count, Handler_Type &handler) {
+	bool ok = true;
+	const Handler_Clause_Table &table = handler.clauses;
+
+	bool found = table.size() == count;
+	for (size_t i = 0; i < count; i++) {
+		const Handler_Clause *c = table.find(effects_handled[i].id());
+		found &= c && c->id == effects_handled[i].id();
+	}
+	for (size_t i = count; i < effect_count; i++)
+		found &= table.find(effects_handled[i].id()) == nullptr;
+	found &= table.find(unhandled_effect.id()) == nullptr;
+	ok &= check(name, count, found);
+
+	int sum = handle(handler, [count]() {
+		int sum = 0;
+		for (size_t i = 0; i < count; i++)
+			sum += effects_handled[i](1);
+		return sum;
+	});
+	ok &= check("Dispatch", count, sum == int(count + 100 * count * (count - 1) / 2));
+
+	return ok;
+}
+
+int main() {
+	bool ok = true;
+
+	Handler<int, int> small = make_erased(std::make_index_sequence<4>());
+	ok &= check_handler("Linear", 4, small);
+
+	Handler<int, int> full = make_erased(std::make_index_sequence<8>());
+	ok &= check_handler("Linear", 8, full);
+
+	Handler<int, int> large = make_erased(std::make_index_sequence<effect_count>());
+	ok &= check_handler("Binary", effect_count, large);
+
+	auto large_static = make_static(std::make_index_sequence<effect_count>());
+	ok &= check_handler("Static binary", effect_count, large_static);
+
+	// The first clause of an effect is used.
+	Handler<int, int> duplicate{
+		{
+			{ effects_handled[0], [](int x) { return x + 1; } },
+			{ effects_handled[0], [](int x) { return x + 2; } }
+		}
+	};
+	ok &= check("Duplicate", duplicate.clauses.size(),
+				duplicate.clauses.size() == 1 && handle(duplicate, []() { return effects_handled[0](0); }) == 1);
+
+	return ok ? 0 : 1;
+}
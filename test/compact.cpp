@@ -0,0 +1,86 @@
+#include <iostream>
+#include "effects/effects.h"
+
+/**
+ * Checks that compacted snapshots are restored correctly, and that compacting only affects
+ * snapshots that have been idle long enough.
+ */
+
+using namespace effects;
+
+Effect<int (int)> choose;
+
+// Bytes saved by compacting snapshots that were idle, and by compacting with a long idle time.
+static size_t saved = 0;
+static size_t saved_early = 0;
+
+// Did the memory usage reflect the saved bytes?
+static bool usage_ok = true;
+
+// Compact all snapshots, then resume the continuation with each choice.
+Handler<int, int> all_choices{
+	{ choose, [](int choices, const Continuation<int, int> &cont) {
+			// Nothing has been idle for an hour.
+			saved_early += compact_snapshots(std::chrono::hours(1));
+
+			Snapshot_Memory_Usage before = snapshot_memory_usage();
+			size_t now = compact_snapshots(std::chrono::seconds(0));
+			Snapshot_Memory_Usage after = snapshot_memory_usage();
+			saved += now;
+			usage_ok &= after.physical + now == before.physical && after.logical == before.logical;
+
+			int total = 0;
+			for (int i = 0; i < choices; i++)
+				total += cont(+i);
+			return total;
+		} }
+};
+
+// Number of choices made at the bottom of the stack.
+static const int decisions = 4;
+
+// Number of pointers in each frame.
+static const size_t slots = 128;
+
+// Recurse "depth" times with mostly zeros and some pointers on the stack in each frame, then
+// make a number of choices. Returns 1 if the data in all frames were intact afterwards.
+static int deep(int depth) {
+	const void *data[slots] = {};
+	for (size_t i = 0; i < slots; i += 8)
+		data[i] = &data[i];
+
+	int result;
+	if (depth == 0) {
+		int sum = 0;
+		for (int i = 0; i < decisions; i++)
+			sum += choose(2);
+		result = sum >= 0 ? 1 : 0;
+	} else {
+		result = deep(depth - 1);
+	}
+
+	for (size_t i = 0; i < slots; i++)
+		if (data[i] != (i % 8 == 0 ? &data[i] : nullptr))
+			return 0;
+	return result;
+}
+
+int main() {
+	Snapshot_Config config;
+	config.compactable = true;
+	snapshot_config(config);
+
+	int result = handle(all_choices, []() { return deep(20); }, Stack_Size(1024 * 1024));
+	Snapshot_Memory_Usage usage = snapshot_memory_usage();
+
+	std::cout << "Result: " << result << std::endl;
+	std::cout << "Saved: " << saved << std::endl;
+	std::cout << "Saved early: " << saved_early << std::endl;
+
+	bool ok = result == 1 << decisions;
+	ok &= saved > 0;
+	ok &= saved_early == 0;
+	ok &= usage_ok;
+	ok &= usage.count == 0 && usage.physical == 0;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,66 @@
+#include <iostream>
+#include "effects/effects.h"
+
+/**
+ * Checks that cached handler lookups are not used after the handlers they refer to are replaced:
+ * when a continuation is resumed under a different handler, and when a new handler frame is
+ * allocated where an old one was.
+ */
+
+using namespace effects;
+
+Effect<int (int)> ask_effect;
+Effect<int (int)> choose_effect;
+
+Handler<int, int> ask_one{
+	{ ask_effect, [](int) { return 1; } }
+};
+
+Handler<int, int> ask_two{
+	{ ask_effect, [](int) { return 2; } }
+};
+
+// Resume the continuation under "ask_two", and then under the handler of the clause.
+Handler<int, int> choose_handler{
+	{ choose_effect, [](int, const Continuation<int, int> &cont) {
+			int first = handle(ask_two, [&cont]() { return cont(0); });
+			int second = cont(1);
+			return first * 1000 + second;
+		} }
+};
+
+// Check a result.
+static bool check(const char *name, int result, int expected) {
+	std::cout << name << ": " << result << std::endl;
+	if (result != expected) {
+		std::cout << "  expected " << expected << std::endl;
+		return false;
+	}
+	return true;
+}
+
+int main() {
+	bool ok = true;
+
+	// The second lookup from the same frame finds a different handler each time the continuation
+	// is resumed, even though no handler frame is created in between.
+	int result = handle(ask_one, []() {
+		return handle(choose_handler, []() {
+			int before = ask_effect(0);
+			int choice = choose_effect(0);
+			int after = ask_effect(0);
+			return before * 100 + choice * 10 + after;
+		});
+	});
+	ok &= check("Relinked", result, 102 * 1000 + 111);
+
+	// Frames of different handlers reuse the same memory.
+	int sum = 0;
+	for (int i = 0; i < 100; i++) {
+		sum += handle(ask_one, []() { return ask_effect(0); });
+		sum += handle(ask_two, []() { return ask_effect(0); });
+	}
+	ok &= check("Reused", sum, 300);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,128 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <new>
+#include <csignal>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "effects/effects.h"
+
+/**
+ * Creates a large number of simultaneously suspended handler frames, more than what would fit in
+ * the default vm.max_map_count if each stack was a separate mapping, and checks that overflowing a
+ * stack hits its guard page.
+ */
+
+using namespace effects;
+
+const size_t frame_count = 200000;
+
+Effect<size_t (size_t)> count_effect;
+
+Handler<size_t, size_t> count_handler{
+	{
+		{
+			count_effect,
+			[](size_t param, const Continuation<size_t, size_t> &cont) {
+				return cont(param + 1);
+			}
+		}
+	},
+	[](size_t result) { return result; },
+	Stack_Size(16 * 1024)
+};
+
+// Read a number from a file.
+size_t read_number(const char *file) {
+	std::ifstream in(file);
+	size_t result = 0;
+	in >> result;
+	return result;
+}
+
+// Number of mappings in the process.
+size_t mappings() {
+	std::ifstream in("/proc/self/maps");
+	std::string line;
+	size_t count = 0;
+	while (std::getline(in, line))
+		count++;
+	return count;
+}
+
+size_t max_mappings = 0;
+
+// Create "depth" nested frames, each of them suspended until the innermost one is done.
+size_t nest(size_t depth) {
+	if (depth == 0) {
+		max_mappings = mappings();
+		return 0;
+	}
+
+	return handle(count_handler, [depth]() {
+		return count_effect(nest(depth - 1));
+	});
+}
+
+// Depth at which overflow() stops. Volatile, so that the compiler does not see that the recursion
+// never ends in practice.
+static volatile size_t overflow_limit = SIZE_MAX;
+
+// Recurse until the stack overflows.
+size_t overflow(size_t depth) {
+	if (depth > overflow_limit)
+		return 0;
+	volatile char data[512];
+	data[0] = char(depth);
+	return overflow(depth + 1) + data[0];
+}
+
+// Overflow a stack in a child process. Returns true if it was killed by SIGSEGV.
+bool overflow_hits_guard() {
+	pid_t child = fork();
+	if (child == 0) {
+		handle(count_handler, []() { return overflow(0); });
+		_exit(0);
+	}
+
+	int status = 0;
+	waitpid(child, &status, 0);
+	return WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV;
+}
+
+int main() {
+	try {
+		size_t result = nest(frame_count);
+		std::cout << "Frames: " << result << ", mappings: " << max_mappings << std::endl;
+
+		if (result != frame_count) {
+			std::cout << "ERROR: Expected " << frame_count << " frames." << std::endl;
+			return 1;
+		}
+
+		// Stacks share mappings.
+		if (max_mappings > frame_count / 10) {
+			std::cout << "ERROR: Expected stacks to share mappings." << std::endl;
+			return 1;
+		}
+	} catch (const std::bad_alloc &) {
+		// Without MADV_GUARD_INSTALL, each guard page costs a mapping. Allocation may then only fail
+		// once the limit is reached. Guard pages stay installed, so the mappings remain.
+		size_t count = mappings();
+		size_t limit = read_number("/proc/sys/vm/max_map_count");
+		std::cout << "Out of mappings: " << count << " of " << limit << std::endl;
+		if (count + 1000 < limit) {
+			std::cout << "ERROR: Allocation failed before the mapping limit was reached." << std::endl;
+			return 1;
+		}
+	}
+
+	if (!overflow_hits_guard()) {
+		std::cout << "ERROR: Stack overflow did not hit the guard page." << std::endl;
+		return 1;
+	}
+	std::cout << "Guard page: ok" << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,141 @@
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "effects/effects.h"
+
+/**
+ * Checks that move-only types can be passed through effects, continuations and return handlers,
+ * and that other values are moved rather than copied. Clauses with a multi-shot continuation
+ * receive the arguments of the effect as lvalues, as they are not moved out of the captured stack.
+ */
+
+using namespace effects;
+
+typedef std::unique_ptr<int> Int_Ptr;
+
+Effect<Int_Ptr (Int_Ptr)> tail_effect;
+Effect<Int_Ptr (Int_Ptr)> one_shot_effect;
+Effect<Int_Ptr (int)> multi_shot_effect;
+
+Handler<Int_Ptr, Int_Ptr> handler{
+	{
+		{ tail_effect, [](Int_Ptr x) { *x += 1; return x; } },
+		{ one_shot_effect, [](Int_Ptr x, const One_Shot_Continuation<Int_Ptr, Int_Ptr> &cont) {
+				*x += 10;
+				return cont(std::move(x));
+			} },
+		{ multi_shot_effect, [](int x, const Continuation<Int_Ptr, Int_Ptr> &cont) {
+				Int_Ptr a = cont(std::make_unique<int>(x + 100));
+				Int_Ptr b = cont(std::make_unique<int>(x + 200));
+				*a += *b;
+				return a;
+			} }
+	},
+	[](Int_Ptr x) { *x *= 2; return x; }
+};
+
+// Value that counts how many times it is copied.
+struct Payload {
+	static size_t copies;
+
+	std::vector<int> data;
+
+	Payload(std::vector<int> data) : data(std::move(data)) {}
+
+	Payload(const Payload &o) : data(o.data) {
+		copies++;
+	}
+
+	Payload(Payload &&o) = default;
+	Payload &operator =(const Payload &o) = delete;
+	Payload &operator =(Payload &&o) = default;
+};
+
+size_t Payload::copies = 0;
+
+Effect<Payload (Payload)> payload_effect;
+
+Handler<Payload, Payload> payload_handler{
+	{ payload_effect, [](Payload x, const One_Shot_Continuation<Payload, Payload> &cont) {
+			x.data.push_back(2);
+			return cont(std::move(x));
+		} }
+};
+
+Effect<void (int)> void_effect;
+
+Effect<int (std::string)> string_effect;
+
+// Check a condition.
+static bool check(const char *name, bool ok) {
+	std::cout << name << ": " << (ok ? "ok" : "failed") << std::endl;
+	return ok;
+}
+
+int main() {
+	bool ok = true;
+
+	Int_Ptr result = handle(handler, []() {
+		Int_Ptr x = tail_effect(std::make_unique<int>(1));
+		x = one_shot_effect(std::move(x));
+
+		// Nothing that owns memory may be on the stack when a multi-shot continuation is
+		// captured.
+		int value = *x;
+		x.reset();
+		return multi_shot_effect(value);
+	});
+	// Tail: 2, one-shot: 12, multi-shot: 2 * 112 + 2 * 212.
+	ok &= check("Move-only", result && *result == 648);
+
+	Payload payload = handle(payload_handler, []() {
+		Payload p(std::vector<int>(1000, 1));
+		return payload_effect(std::move(p));
+	});
+	ok &= check("Payload", payload.data.size() == 1001 && payload.data.back() == 2);
+	ok &= check("No copies", Payload::copies == 0);
+
+	// Effects accept lvalues, and handlers may produce void.
+	int sum = 0;
+	auto void_handler = make_handler<void>(clause(void_effect, [&sum](int x) { sum += x; }));
+	handle(void_handler, []() {
+		int x = 5;
+		void_effect(x);
+		void_effect(x);
+	});
+	ok &= check("Void", sum == 10);
+
+	// Owning arguments are left in place for a multi-shot continuation.
+	int length = handle(make_handler<int>(clause(string_effect, [](const std::string &x, const Continuation<int, int> &cont) {
+						return cont(x.size());
+					})), []() {
+		return string_effect(std::string(100, 'x'));
+	});
+	ok &= check("Multi-shot argument", length == 100);
+
+	length = handle(make_handler<int>(clause(string_effect, [](std::string x, const Continuation<int, int> &cont) {
+					return cont(x.size());
+				})), []() {
+		std::string x(100, 'x');
+		return string_effect(x);
+	});
+	ok &= check("Multi-shot argument by value", length == 100);
+
+	// An exception from resuming a continuation can be handled by the clause.
+	int caught = handle(make_handler<int>(clause(multi_shot_effect, [](int, const Continuation<int, Int_Ptr> &cont) {
+					try {
+						return cont(nullptr);
+					} catch (const std::exception &) {
+						return -1;
+					}
+				})), []() {
+		multi_shot_effect(0);
+		throw std::runtime_error("error");
+		return 0;
+	});
+	ok &= check("Caught", caught == -1);
+
+	return ok ? 0 : 1;
+}
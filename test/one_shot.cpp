@@ -0,0 +1,93 @@
+#include <iostream>
+#include "effects/effects.h"
+
+/**
+ * Checks one-shot continuations: resuming them, resuming them twice, and abandoning them.
+ */
+
+using namespace effects;
+
+Effect<int (int)> resume_effect;
+Effect<int (int)> twice_effect;
+Effect<int (int)> abandon_effect;
+
+// Did resuming a continuation a second time throw?
+static bool threw = false;
+
+Handler<int, int> handler{
+	{
+		{ resume_effect, [](int x, const One_Shot_Continuation<int, int> &cont) {
+				return cont(x * 10);
+			} },
+		{ twice_effect, [](int x, const One_Shot_Continuation<int, int> &cont) {
+				int result = cont(x);
+				try {
+					cont(x);
+				} catch (const continuation_resumed &) {
+					threw = true;
+				}
+				return result;
+			} },
+		{ abandon_effect, [](int x, const One_Shot_Continuation<int, int> &) {
+				return -x;
+			} }
+	}
+};
+
+// Counts live instances.
+class Counted {
+public:
+	static int live;
+
+	Counted() {
+		live++;
+	}
+
+	~Counted() {
+		live--;
+	}
+};
+
+int Counted::live = 0;
+
+// Check a condition.
+static bool check(const char *name, bool ok) {
+	std::cout << name << ": " << (ok ? "ok" : "failed") << std::endl;
+	return ok;
+}
+
+int main() {
+	bool ok = true;
+
+	int result = handle(handler, []() {
+		Shared_Ptr<Counted> c = mk_shared<Counted>();
+		int a = resume_effect(1);
+		int b = resume_effect(2);
+		return a + b;
+	});
+	ok &= check("Resumed", result == 30);
+	ok &= check("Released after resuming", Counted::live == 0);
+
+	result = handle(handler, []() {
+		return twice_effect(5) + 1;
+	});
+	ok &= check("Resumed once", result == 6);
+	ok &= check("Second resume throws", threw);
+
+	// The continuation is never resumed, so the code after the effect does not run. The
+	// references of the Shared_Ptrs on its stack are released when the clause returns.
+	Shared_Ptr<Counted> outer = mk_shared<Counted>();
+	bool after_effect = false;
+	result = handle(handler, [outer, &after_effect]() {
+		Shared_Ptr<Counted> copy = outer;
+		Shared_Ptr<Counted> inner = mk_shared<Counted>();
+		int x = abandon_effect(7);
+		after_effect = true;
+		return x;
+	});
+	ok &= check("Abandoned", result == -7 && !after_effect);
+	ok &= check("References released", outer.use_count() == 1);
+	ok &= check("Objects released", Counted::live == 1);
+
+	return ok ? 0 : 1;
+}
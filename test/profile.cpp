@@ -0,0 +1,108 @@
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include "effects/effects.h"
+
+/**
+ * Checks the latency histograms, and the profiles recorded with EFFECTS_PROFILE.
+ */
+
+using namespace effects;
+
+Effect<int (int)> tail_effect("tail");
+Effect<int (int)> slow_effect("slow");
+
+// Time the clause of "slow_effect" sleeps.
+static const auto clause_time = std::chrono::milliseconds(2);
+
+// Time the body sleeps after each "slow_effect".
+static const auto resume_time = std::chrono::milliseconds(5);
+
+Handler<int, int> handler{
+	{
+		{ tail_effect, [](int x) { return x + 1; } },
+		{ slow_effect, [](int x, const Continuation<int, int> &cont) {
+				std::this_thread::sleep_for(clause_time);
+				return cont(x + 1);
+			} }
+	}
+};
+
+static bool check(const char *what, bool ok) {
+	if (!ok)
+		std::cout << "Failed: " << what << std::endl;
+	return ok;
+}
+
+#ifdef EFFECTS_PROFILE
+static uint64_t ns(std::chrono::nanoseconds d) {
+	return d.count();
+}
+#endif
+
+int main() {
+	bool ok = true;
+
+	// Buckets are contiguous, and each value is in the bucket that contains it.
+	for (size_t i = 0; i + 1 < Latency_Histogram::bucket_count; i++)
+		ok &= check("contiguous", Latency_Histogram::bucket_high(i) + 1 == Latency_Histogram::bucket_low(i + 1));
+	for (uint64_t v : { 0ull, 1ull, 7ull, 8ull, 9ull, 100ull, 1000ull, 123456789ull, 1ull << 40, ~0ull }) {
+		size_t b = Latency_Histogram::bucket(v);
+		ok &= check("bucket", Latency_Histogram::bucket_low(b) <= v && v <= Latency_Histogram::bucket_high(b));
+	}
+
+	Latency_Histogram h;
+	for (uint64_t i = 1; i <= 1000; i++)
+		h.record(i * 1000);
+	std::cout << "p50: " << h.percentile(0.5) << ", p99: " << h.percentile(0.99) << std::endl;
+	ok &= check("count", h.count() == 1000);
+	ok &= check("p50", h.percentile(0.5) >= 500000 && h.percentile(0.5) <= 500000 * 9 / 8);
+	ok &= check("p99", h.percentile(0.99) >= 990000 && h.percentile(0.99) <= 1000000);
+	ok &= check("max", h.percentile(1.0) == 1000000);
+
+	Latency_Histogram earlier = h;
+	h.record(5);
+	h -= earlier;
+	ok &= check("subtract", h.count() == 1 && h.total() == 5);
+
+	const int rounds = 4;
+	handle(handler, []() {
+		int x = 0;
+		for (int i = 0; i < rounds; i++) {
+			x = tail_effect(+x);
+			x = slow_effect(+x);
+			std::this_thread::sleep_for(resume_time);
+		}
+		return x;
+	});
+
+	Effect_Profile tail = effect_profile(tail_effect.id());
+	Effect_Profile slow = effect_profile(slow_effect.id());
+
+#ifdef EFFECTS_PROFILE
+	std::cout << "slow latency: " << slow.latency.percentile(0.5)
+			  << ", clause: " << slow.clause.percentile(0.5)
+			  << ", resume: " << slow.resume.percentile(0.5) << std::endl;
+
+	ok &= check("tail counts", tail.latency.count() == rounds && tail.clause.count() == rounds && tail.resume.count() == 0);
+	ok &= check("slow counts", slow.latency.count() == rounds && slow.clause.count() == rounds && slow.resume.count() == rounds);
+	ok &= check("name", std::string(slow.name) == "slow");
+
+	// The clause and the latency include the time the clause sleeps, and the resumption includes
+	// the time the body sleeps before the next effect. Sleeps may take longer than requested, so
+	// only lower bounds are checked.
+	ok &= check("clause time", slow.clause.percentile(0.5) >= ns(clause_time));
+	ok &= check("resume time", slow.resume.percentile(0.5) >= ns(resume_time));
+	ok &= check("latency", slow.latency.percentile(0.5) >= ns(clause_time));
+
+	bool found = false;
+	for (const Effect_Profile &p : effect_profiles())
+		found |= p.id == slow_effect.id();
+	ok &= check("listed", found);
+#else
+	ok &= check("disabled", slow.latency.count() == 0 && effect_profiles().empty());
+	(void)tail;
+#endif
+
+	return ok ? 0 : 1;
+}
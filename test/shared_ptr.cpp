@@ -0,0 +1,116 @@
+#include <iostream>
+#include <vector>
+#include "effects/effects.h"
+
+/**
+ * Checks the reference counts of Shared_Ptrs on stacks that are captured in multi-shot
+ * continuations, restored several times, and abandoned.
+ */
+
+using namespace effects;
+
+Effect<int (int)> choose_effect;
+Effect<int (int)> abandon_effect;
+Effect<int (int)> other_effect;
+
+// Resume the continuation with 0, 1 and 2.
+Handler<int, int> choose_handler{
+	{ choose_effect, [](int, const Continuation<int, int> &cont) {
+			return cont(0) + cont(1) + cont(2);
+		} }
+};
+
+// Never resume the continuation.
+Handler<int, int> abandon_handler{
+	{ abandon_effect, [](int x, const Continuation<int, int> &) {
+			return -x;
+		} }
+};
+
+// Never performed. Gives the body its own frame.
+Handler<int, int> other_handler{
+	{ other_effect, [](int x) { return x; } }
+};
+
+// Counts live instances.
+class Counted {
+public:
+	static int live;
+
+	Counted() {
+		live++;
+	}
+
+	~Counted() {
+		live--;
+	}
+};
+
+int Counted::live = 0;
+
+// Check a condition.
+static bool check(const char *name, bool ok) {
+	std::cout << name << ": " << (ok ? "ok" : "failed") << std::endl;
+	return ok;
+}
+
+// Are all elements in "v" equal, and is there "count" of them?
+static bool all_equal(const std::vector<size_t> &v, size_t count) {
+	for (size_t x : v)
+		if (x != v.front())
+			return false;
+	return v.size() == count;
+}
+
+int main() {
+	bool ok = true;
+
+	// Pointers on the stacks of two frames are restored for each resumption. Each resumption sees
+	// the same counts, regardless of how many times the continuation was resumed before.
+	Shared_Ptr<Counted> outer = mk_shared<Counted>();
+	std::vector<size_t> outer_counts, frame_counts, inner_counts;
+	int result = handle(choose_handler, [&]() {
+		Shared_Ptr<Counted> copy = outer;
+		Shared_Ptr<Counted> frame = mk_shared<Counted>();
+		return handle(other_handler, [&outer_counts, &frame_counts, &inner_counts, &copy, &frame]() {
+			Shared_Ptr<Counted> inner = mk_shared<Counted>();
+			Shared_Ptr<Counted> inner_copy = inner;
+			int a = choose_effect(0);
+			int b = choose_effect(0);
+			outer_counts.push_back(copy.use_count());
+			frame_counts.push_back(frame.use_count());
+			inner_counts.push_back(inner.use_count());
+			return a * 3 + b;
+		});
+	});
+	std::cout << "Counts: " << outer_counts.front() << ", " << frame_counts.front() << ", " << inner_counts.front() << std::endl;
+	// Each of the 9 combinations of "a" and "b" occurs once: 3 * 9 + 9.
+	ok &= check("Resumed", result == 36);
+	ok &= check("Outer counts", all_equal(outer_counts, 9));
+	ok &= check("Frame counts", all_equal(frame_counts, 9));
+	ok &= check("Inner counts", all_equal(inner_counts, 9));
+	ok &= check("Released after resuming", outer.use_count() == 1 && Counted::live == 1);
+
+	// Abandoned continuations release their references.
+	result = handle(abandon_handler, [outer]() {
+		Shared_Ptr<Counted> copy = outer;
+		Shared_Ptr<Counted> inner = mk_shared<Counted>();
+		return handle(other_handler, [inner]() {
+			Shared_Ptr<Counted> innermost = inner;
+			return abandon_effect(5);
+		});
+	});
+	ok &= check("Abandoned", result == -5);
+	ok &= check("Released after abandoning", outer.use_count() == 1 && Counted::live == 1);
+
+	// Snapshots taken in a loop do not accumulate references.
+	for (int i = 0; i < 100; i++) {
+		handle(choose_handler, [outer]() {
+			Shared_Ptr<Counted> copy = outer;
+			return choose_effect(0);
+		});
+	}
+	ok &= check("Repeated", outer.use_count() == 1 && Counted::live == 1);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,135 @@
+#include <iostream>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include "effects/effects.h"
+
+/**
+ * Checks that multi-shot continuations of deep stacks are restored correctly, with and without
+ * copy-on-write snapshots and deduplication, that deduplication shares the deep part of the
+ * stacks, and that copy-on-write snapshots respect the limit on mapped runs of pages.
+ */
+
+using namespace effects;
+
+Effect<int (int)> choose;
+
+// Number of mappings in the process.
+static size_t mappings() {
+	std::ifstream in("/proc/self/maps");
+	std::string line;
+	size_t count = 0;
+	while (std::getline(in, line))
+		count++;
+	return count;
+}
+
+// Largest memory usage of snapshots and number of mappings seen by the handler.
+static Snapshot_Memory_Usage peak;
+static size_t peak_mappings;
+
+// Resume the continuation with each choice, and count the results.
+Handler<int, int> all_choices{
+	{ choose, [](int choices, const Continuation<int, int> &cont) {
+			Snapshot_Memory_Usage usage = snapshot_memory_usage();
+			if (usage.logical > peak.logical)
+				peak = usage;
+			peak_mappings = std::max(peak_mappings, mappings());
+
+			int total = 0;
+			for (int i = 0; i < choices; i++)
+				total += cont(+i);
+			return total;
+		} }
+};
+
+// Number of choices made at the bottom of the stack.
+static const int decisions = 6;
+
+// Recurse "depth" times with some data on the stack in each frame, then make a number of choices.
+// Returns 1 if the data in all frames were intact afterwards.
+static int deep(int depth) {
+	char data[1000];
+	std::memset(data, depth, sizeof(data));
+
+	int result;
+	if (depth == 0) {
+		int sum = 0;
+		for (int i = 0; i < decisions; i++) {
+			// Make the top of the stack different for each choice.
+			char scratch[3000];
+			std::memset(scratch, i, sizeof(scratch));
+			sum += choose(2) + scratch[i];
+		}
+		result = sum >= decisions * (decisions - 1) / 2 ? 1 : 0;
+	} else {
+		result = deep(depth - 1);
+	}
+
+	for (char c : data)
+		if (c != char(depth))
+			return 0;
+	return result;
+}
+
+static bool run(const char *name, bool copy_on_write, bool deduplicate, size_t depth, size_t max_runs = Snapshot_Config().max_mapped_runs) {
+	Snapshot_Config config;
+	config.copy_on_write = copy_on_write;
+	config.deduplicate = deduplicate;
+	config.max_mapped_runs = max_runs;
+	snapshot_config(config);
+
+	peak = Snapshot_Memory_Usage();
+	size_t initial_mappings = mappings();
+	peak_mappings = initial_mappings;
+	Stats before = stats();
+	int result = handle(all_choices, [depth]() { return deep(int(depth)); }, Stack_Size(1024 * 1024));
+	Stats after = stats();
+	Snapshot_Memory_Usage usage = snapshot_memory_usage();
+
+	std::cout << name << (deduplicate ? " (deduplicated)" : "") << ", depth " << depth << ": " << result
+			  << ", pages mapped: " << (after.pages_mapped - before.pages_mapped)
+			  << ", pages shared: " << (after.pages_shared - before.pages_shared)
+			  << ", peak bytes: " << peak.logical << " logical, " << peak.physical << " physical"
+			  << ", added mappings: " << (peak_mappings - initial_mappings) << std::endl;
+
+	bool ok = result == 1 << decisions;
+
+	// Each run of pages costs at most two mappings. Allow for the chunks of the memory file.
+	if (peak_mappings > initial_mappings + 2 * max_runs + 8) {
+		std::cout << "  too many mappings" << std::endl;
+		ok = false;
+	}
+
+	// Everything should be released afterwards.
+	if (usage.count != 0 || usage.logical != 0 || usage.physical != 0) {
+		std::cout << "  snapshots remain: " << usage.count << std::endl;
+		ok = false;
+	}
+
+	// The deep stack is shared by all continuations that are alive at the same time.
+	if (deduplicate && depth >= 200 && peak.physical * 2 > peak.logical) {
+		std::cout << "  pages were not shared" << std::endl;
+		ok = false;
+	}
+
+	return ok;
+}
+
+int main() {
+	bool ok = true;
+
+	for (size_t depth : { 0, 10, 200 }) {
+		for (bool deduplicate : { false, true }) {
+			ok &= run("Copy", false, deduplicate, depth);
+			ok &= run("Copy-on-write", true, deduplicate, depth);
+		}
+	}
+
+	// Pages beyond the limit are copied instead.
+	ok &= run("Copy-on-write (4 runs)", true, true, 200, 4);
+	ok &= run("Copy-on-write (no runs)", true, false, 200, 0);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,103 @@
+#include <iostream>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "effects/effects.h"
+
+/**
+ * Checks that the pages of a stack that was used deeply are returned to the OS when the stack is
+ * returned to the pool, even if the frame was never suspended while the stack was deep, and that
+ * stacks may be destroyed by another thread than the one that allocated them.
+ */
+
+using namespace effects;
+
+Effect<int (int)> tail_effect;
+
+Handler<int, int> handler{
+	{ tail_effect, [](int x) { return x + 1; } }
+};
+
+// Use about "depth" kilobytes of stack.
+static int deep(int depth) {
+	volatile char data[1024];
+	data[0] = char(depth);
+	if (depth == 0)
+		return tail_effect(data[0]);
+	return deep(depth - 1) + data[0] - char(depth);
+}
+
+// Check a condition.
+static bool check(const char *name, bool ok) {
+	std::cout << name << ": " << (ok ? "ok" : "failed") << std::endl;
+	return ok;
+}
+
+int main() {
+	Stack_Pool_Config config = Stack_Pool::config();
+	config.lazy_release = false;
+	Stack_Pool::config(config);
+
+	bool ok = true;
+
+	size_t resident = 0;
+	int result = handle(handler, [&resident]() {
+		int result = deep(512);
+		resident = Stack::live_usage().resident;
+		return result;
+	});
+	ok &= check("Result", result == 1);
+	std::cout << "Resident while running: " << resident << std::endl;
+	ok &= check("Used deeply", resident >= 512 * 1024);
+
+	Stack_Memory_Usage pooled = Stack_Pool::usage();
+	std::cout << "Resident in pool: " << pooled.resident << std::endl;
+	ok &= check("Pooled", pooled.count == 1);
+	ok &= check("Released", pooled.resident <= Stack_Pool::release_threshold());
+	ok &= check("No live stacks", Stack::live_usage().count == 0);
+
+#ifndef EFFECTS_SINGLE_THREADED
+	// Destroy stacks from another thread while their thread allocates and destroys stacks.
+	typedef std::vector<std::unique_ptr<Stack>> Stacks;
+	std::promise<Stacks> given;
+	std::promise<void> destroyed;
+	size_t remaining = 0;
+	std::thread owner([&given, &destroyed, &remaining]() {
+		Stacks give;
+		for (int i = 0; i < 100; i++)
+			give.push_back(std::make_unique<Stack>(Stack::allocate, 16 * 1024));
+		given.set_value(std::move(give));
+
+		Stacks kept;
+		for (int i = 0; i < 10000; i++) {
+			Stack temporary(Stack::allocate, 16 * 1024);
+			if (i % 1000 == 0)
+				kept.push_back(std::make_unique<Stack>(Stack::allocate, 16 * 1024));
+		}
+
+		destroyed.get_future().wait();
+		remaining = Stack::live_usage().count;
+	});
+
+	Stacks received = given.get_future().get();
+	received.clear();
+	destroyed.set_value();
+	owner.join();
+	ok &= check("Other thread", remaining == 10);
+
+	// Stacks may outlive the thread that allocated them, and do not affect the stacks of the
+	// thread that destroys them.
+	Stack mine(Stack::allocate, 16 * 1024);
+	Stacks orphans;
+	std::thread([&orphans]() {
+		for (int i = 0; i < 10; i++)
+			orphans.push_back(std::make_unique<Stack>(Stack::allocate, 16 * 1024));
+	}).join();
+	while (!orphans.empty())
+		orphans.pop_back();
+	ok &= check("Orphans", Stack::live_usage().count == 1);
+#endif
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,110 @@
+#include <iostream>
+#include <new>
+#include <thread>
+#include "effects/effects.h"
+
+/**
+ * Checks that stacks are reused from the pool of the current thread, that pools can be pre-warmed
+ * and are capped, and that failing to allocate a stack is reported.
+ */
+
+using namespace effects;
+
+const size_t size = 16 * 1024;
+
+// Check a condition.
+static bool check(const char *name, bool ok) {
+	std::cout << name << ": " << (ok ? "ok" : "failed") << std::endl;
+	return ok;
+}
+
+int main() {
+	bool ok = true;
+
+	// A released stack is returned to the pool, and reused by the next allocation.
+	Stack_Pool::clear();
+	Stack_Memory memory = Stack_Pool::allocate(size);
+	void *base = memory.base;
+	ok &= check("Allocated", base != nullptr);
+	Stack_Pool::release(memory);
+	ok &= check("Returned", Stack_Pool::free_count() == 1);
+
+	Stats before = stats();
+	memory = Stack_Pool::allocate(size);
+	Stats after = stats();
+	ok &= check("Reused", memory.base == base);
+	ok &= check("Taken", Stack_Pool::free_count() == 0);
+	Stack_Pool::release(memory);
+#ifndef EFFECTS_NO_STATS
+	ok &= check("Not mapped", after.stacks_mapped == before.stacks_mapped);
+#else
+	(void)before;
+	(void)after;
+#endif
+
+	// Stacks of other sizes are not reused.
+	memory = Stack_Pool::allocate(4 * size);
+	ok &= check("Other size", memory.base != base && Stack_Pool::free_count() == 1);
+	Stack_Pool::release(memory);
+	Stack_Pool::clear();
+
+	// Destroying a stack returns it to the pool.
+	{
+		Stack stack(Stack::allocate, size);
+		ok &= check("Taken by stack", Stack_Pool::free_count() == 0);
+	}
+	ok &= check("Returned by stack", Stack_Pool::free_count() == 1);
+	Stack_Pool::clear();
+	ok &= check("Cleared", Stack_Pool::free_count() == 0);
+
+	// Pre-warmed stacks are used before new ones are allocated.
+	Stack_Pool::prewarm(4, size);
+	ok &= check("Pre-warmed", Stack_Pool::free_count() == 4);
+	before = stats();
+	{
+		Stack a(Stack::allocate, size), b(Stack::allocate, size), c(Stack::allocate, size), d(Stack::allocate, size);
+		ok &= check("Pre-warmed taken", Stack_Pool::free_count() == 0);
+	}
+	after = stats();
+#ifndef EFFECTS_NO_STATS
+	ok &= check("Pre-warmed not mapped", after.stacks_mapped == before.stacks_mapped);
+#endif
+	ok &= check("Pre-warmed returned", Stack_Pool::free_count() == 4);
+
+	// Stacks beyond the cap are returned to the slabs.
+	Stack_Pool_Config config = Stack_Pool::config();
+	Stack_Pool_Config capped = config;
+	capped.max_free = 2;
+	Stack_Pool::config(capped);
+	Stack_Pool::clear();
+	{
+		Stack a(Stack::allocate, size), b(Stack::allocate, size), c(Stack::allocate, size), d(Stack::allocate, size);
+	}
+	ok &= check("Capped", Stack_Pool::free_count() == 2);
+	Stack_Pool::config(config);
+
+#ifndef EFFECTS_SINGLE_THREADED
+	// New threads are pre-warmed by their first allocation.
+	capped = config;
+	capped.prewarm = 3;
+	Stack_Pool::config(capped);
+	size_t warm = 0;
+	std::thread([&warm]() {
+		Stack stack(Stack::allocate);
+		warm = Stack_Pool::free_count();
+	}).join();
+	ok &= check("Pre-warmed thread", warm == 2);
+	Stack_Pool::config(config);
+#endif
+
+	// Allocations that cannot be satisfied throw, rather than returning an invalid stack.
+	bool failed = false;
+	try {
+		Stack stack(Stack::allocate, size_t(1) << 50);
+	} catch (const std::bad_alloc &) {
+		failed = true;
+	}
+	ok &= check("Too large", failed);
+
+	return ok ? 0 : 1;
+}
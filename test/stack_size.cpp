@@ -0,0 +1,75 @@
+#include <iostream>
+#include "effects/effects.h"
+
+/**
+ * Checks that stack sizes can be chosen per handler and per call to handle(), and that adaptive
+ * sizes follow the stack usage of the frames, regardless of how earlier owners of the stacks used
+ * them.
+ */
+
+using namespace effects;
+
+Effect<int (int)> tail_effect;
+
+// Use about "depth" kilobytes of stack, then perform an effect.
+static int deep(int depth) {
+	volatile char data[1024];
+	data[0] = char(depth);
+	if (depth == 0)
+		return tail_effect(data[0]);
+	return deep(depth - 1) + data[0] - char(depth);
+}
+
+// Size of the stack of the current frame.
+static size_t current_size() {
+	return Stack::live_usage().reserved;
+}
+
+// Check a condition.
+static bool check(const char *name, bool ok) {
+	std::cout << name << ": " << (ok ? "ok" : "failed") << std::endl;
+	return ok;
+}
+
+int main() {
+	bool ok = true;
+
+	Handler<size_t, size_t> small{
+		{ tail_effect, [](int x) { return x + 1; } },
+		[](size_t x) { return x; },
+		Stack_Size(16 * 1024)
+	};
+
+	size_t size = handle(small, []() { return current_size(); });
+	ok &= check("Per handler", size == Stack_Pool::rounded_size(16 * 1024));
+
+	size = handle(small, []() { return current_size(); }, Stack_Size(256 * 1024));
+	ok &= check("Per call", size == Stack_Pool::rounded_size(256 * 1024));
+
+	size = handle(small, []() { return current_size(); }, Stack_Size());
+	ok &= check("Default", size == Stack_Pool::rounded_size(Stack_Size::default_size));
+
+	// Leave deeply used (but lazily released) stacks of the maximum size in the pool.
+	for (int i = 0; i < 4; i++)
+		handle(small, []() { return size_t(deep(512)); }, Stack_Size());
+
+	// The first frame with an adaptive size uses the maximum, and observes how much of it was
+	// used. The pages touched by earlier owners of its stack do not count.
+	Stack_Size adaptive = Stack_Size::adaptive(Stack_Size::min_size, Stack_Size::default_size, 2);
+	size = handle(small, []() { deep(32); return current_size(); }, adaptive);
+	std::cout << "Adaptive: " << adaptive.bytes() << std::endl;
+	ok &= check("First adaptive", size == Stack_Pool::rounded_size(Stack_Size::default_size));
+	ok &= check("Adapted", adaptive.bytes() >= 2 * 32 * 1024 && adaptive.bytes() <= 256 * 1024);
+
+	// Later frames use the observed size.
+	size_t expected = Stack_Pool::rounded_size(adaptive.bytes());
+	size = handle(small, []() { deep(32); return current_size(); }, adaptive);
+	ok &= check("Second adaptive", size == expected);
+
+	// Copies share their observations.
+	for (int i = 0; i < 16; i++)
+		handle(small, []() { return size_t(deep(32)); }, Stack_Size(adaptive));
+	ok &= check("Shared", adaptive.observed()->frames == 18);
+
+	return ok ? 0 : 1;
+}
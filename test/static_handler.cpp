@@ -0,0 +1,69 @@
+#include <iostream>
+#include <string>
+#include "effects/effects.h"
+
+/**
+ * Tests handlers created by make_handler, which keep the types of their clauses.
+ */
+
+using namespace effects;
+
+Effect<int (int)> get_effect;
+Effect<int (int)> choose_effect;
+Effect<int (int)> once_effect;
+
+// Check a result.
+template <typename T>
+static bool check(const char *name, const T &result, const T &expected) {
+	std::cout << name << ": " << result << std::endl;
+	if (result != expected) {
+		std::cout << "  expected " << expected << std::endl;
+		return false;
+	}
+	return true;
+}
+
+int main() {
+	bool ok = true;
+
+	auto handler = make_handler<int>(
+		clause(get_effect, [](int x) { return x + 1; }),
+		clause(choose_effect, [](int, const Continuation<int, int> &cont) { return cont(0) + cont(1); }),
+		clause(once_effect, [](int x, const One_Shot_Continuation<int, int> &cont) { return cont(x * 2); }));
+
+	ok &= check("Clauses", handle(handler, []() {
+		int a = get_effect(1);
+		int b = choose_effect(0);
+		int c = once_effect(3);
+		return a * 100 + b * 10 + c;
+	}), (200 + 0 + 6) + (200 + 10 + 6));
+
+	// Copies refer to their own clauses.
+	auto copy = handler;
+	ok &= check("Copy", handle(copy, []() { return get_effect(5); }), 6);
+
+	auto to_string = make_handler<int>(
+		[](int x) { return std::to_string(x); },
+		clause(get_effect, [](int x) { return x * 3; }));
+
+	ok &= check("Return handler", handle(to_string, []() { return get_effect(4); }), std::string("12"));
+
+	// Clauses can also be used to create type-erased handlers.
+	Handler<int, int> erased{
+		{
+			clause(get_effect, [](int x) { return x - 1; }),
+			clause(once_effect, [](int x, const One_Shot_Continuation<int, int> &cont) { return cont(x) + 1; })
+		}
+	};
+
+	ok &= check("Type-erased", handle(erased, []() { return get_effect(10) + once_effect(1); }), 11);
+
+	Handler<std::string, int> erased_to_string{
+		clause(choose_effect, [](int, const Continuation<std::string, int> &cont) { return cont(1) + cont(2); }),
+		[](int x) { return std::to_string(x); }
+	};
+
+	ok &= check("Type-erased return handler", handle(erased_to_string, []() { return choose_effect(0); }), std::string("12"));
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,86 @@
+#include <iostream>
+#include "effects/effects.h"
+
+/**
+ * Checks the counters reported by effects::stats().
+ */
+
+using namespace effects;
+
+Effect<int (int)> tail_effect;
+Effect<int (int)> one_shot_effect;
+Effect<int (int)> multi_shot_effect;
+
+// Snapshots alive while the multi-shot clause runs.
+static Snapshot_Memory_Usage in_clause;
+
+Handler<int, int> handler{
+	{
+		{ tail_effect, [](int x) { return x + 1; } },
+		{ one_shot_effect, [](int x, const One_Shot_Continuation<int, int> &cont) { return cont(x + 1); } },
+		{ multi_shot_effect, [](int x, const Continuation<int, int> &cont) {
+				in_clause = snapshot_memory_usage();
+				return cont(x) + cont(x + 1);
+			} }
+	}
+};
+
+// Check that a counter changed by the expected amount.
+static bool check(const char *name, size_t before, size_t after, size_t expected) {
+	std::cout << name << ": " << (after - before) << std::endl;
+	if (after - before != expected) {
+		std::cout << "  expected " << expected << std::endl;
+		return false;
+	}
+	return true;
+}
+
+int main() {
+	bool ok = true;
+
+	// Make sure the first frame of the thread is created.
+	handle(handler, []() { return 0; });
+
+	Stats before = stats();
+	handle(handler, []() {
+		Shared_Ptr<int> p = mk_shared<int>(1);
+		int x = tail_effect(1);
+		x = one_shot_effect(+x);
+		return multi_shot_effect(+x);
+	});
+	Stats after = stats();
+
+	// The continuation is handed to the clause without copying the snapshot of the stack.
+	ok &= check("Snapshots in clause", 0, in_clause.count, 1);
+
+#ifndef EFFECTS_NO_STATS
+	ok &= check("Effects", before.effects_performed, after.effects_performed, 3);
+	ok &= check("Frames", before.frames_created, after.frames_created, 1);
+	ok &= check("Captured", before.continuations_captured, after.continuations_captured, 2);
+	ok &= check("Resumed", before.continuations_resumed, after.continuations_resumed, 3);
+	ok &= check("Live stacks", before.stacks_live, after.stacks_live, 0);
+	ok &= check("Pointer set entries", before.pointer_set_entries, after.pointer_set_entries, 1);
+
+	// Start, two effects that switch to the handler, three resumptions, and the body finishes
+	// twice.
+	ok &= check("Switches", before.context_switches, after.context_switches, 1 + 2 + 3 + 2);
+
+	// The multi-shot continuation is restored twice. The first time, the stack is unchanged since
+	// it was captured, so nothing needs to be written. The second time, at most the captured bytes
+	// are written.
+	size_t captured = after.bytes_captured - before.bytes_captured;
+	size_t restored = after.bytes_restored - before.bytes_restored;
+	std::cout << "Restored: " << restored << std::endl;
+	if (captured == 0 || restored == 0 || restored > captured) {
+		std::cout << "  expected between 1 and " << captured << std::endl;
+		ok = false;
+	}
+	ok &= check("Snapshot bytes in clause", 0, in_clause.logical, captured);
+
+	// Counters of the current thread are the same as the total, since we are alone.
+	Stats thread = thread_stats();
+	ok &= check("Thread effects", 0, thread.effects_performed, after.effects_performed);
+#endif
+
+	return ok ? 0 : 1;
+}
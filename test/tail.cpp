@@ -0,0 +1,108 @@
+#include <iostream>
+#include <stdexcept>
+#include "effects/effects.h"
+
+/**
+ * Tests tail-resumptive handler clauses, which are executed on the stack that performs the
+ * effect.
+ */
+
+using namespace effects;
+
+Effect<int (int)> get_effect;
+Effect<void (int)> put_effect;
+Effect<int (int)> choose_effect;
+
+// Check a result.
+static bool check(const char *name, int result, int expected) {
+	std::cout << name << ": " << result << std::endl;
+	if (result != expected) {
+		std::cout << "  expected " << expected << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// Simple state.
+static int test_state() {
+	int state = 0;
+	Handler<int, int> state_handler{
+		{
+			{ get_effect, [&state](int) { return state; } },
+			{ put_effect, [&state](int value) { state = value; } }
+		}
+	};
+
+	return handle(state_handler, []() {
+		for (int i = 0; i < 1000; i++)
+			put_effect(get_effect(0) + 2);
+		return get_effect(0);
+	});
+}
+
+// Effects performed by a tail-resumptive clause are handled outside of its handler.
+static int test_nested() {
+	Handler<int, int> outer{
+		{ get_effect, [](int param) { return param + 100; } }
+	};
+	Handler<int, int> inner{
+		{ get_effect, [](int param) { return get_effect(param + 1) * 2; } }
+	};
+
+	return handle(outer, [&inner]() {
+		return handle(inner, []() {
+			return get_effect(1);
+		});
+	});
+}
+
+// A tail-resumptive clause performs an effect whose handler resumes the continuation twice.
+static int test_multi_shot() {
+	Handler<int, int> choose_handler{
+		{ choose_effect, [](int, const Continuation<int, int> &cont) { return cont(0) + cont(1); } }
+	};
+	Handler<int, int> get_handler{
+		{ get_effect, [](int) { return 10 + choose_effect(0); } }
+	};
+
+	return handle(choose_handler, [&get_handler]() {
+		return handle(get_handler, []() {
+			int a = get_effect(0);
+			int b = get_effect(0);
+			return a * 100 + b;
+		});
+	});
+}
+
+// Exceptions propagate to where the effect was performed.
+static int test_exception() {
+	Handler<int, int> handler{
+		{
+			get_effect,
+			[](int param) {
+				if (param < 0)
+					throw std::runtime_error("negative");
+				return param;
+			}
+		}
+	};
+
+	return handle(handler, []() {
+		int result = 0;
+		try {
+			get_effect(-1);
+		} catch (const std::runtime_error &) {
+			result += 10;
+		}
+		return result + get_effect(5);
+	});
+}
+
+int main() {
+	bool ok = true;
+	ok &= check("State", test_state(), 2000);
+	ok &= check("Nested", test_nested(), 204);
+	ok &= check("Multi-shot", test_multi_shot(), 4242);
+	ok &= check("Exception", test_exception(), 15);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,171 @@
+#include <iostream>
+#include <sstream>
+#include <map>
+#include <vector>
+#include "effects/effects.h"
+
+/**
+ * Checks the events recorded by trace_start() and written by trace_flush().
+ */
+
+using namespace effects;
+
+Effect<int (int)> tail_effect("tail");
+Effect<int (int)> one_shot_effect("one-shot");
+Effect<int (int)> multi_shot_effect("multi-shot");
+Effect<int (int)> inner_effect("inner");
+
+Handler<int, int> handler{
+	{
+		{ tail_effect, [](int x) { return x + 1; } },
+		{ one_shot_effect, [](int x, const One_Shot_Continuation<int, int> &cont) { return cont(x + 1); } },
+		{ multi_shot_effect, [](int x, const Continuation<int, int> &cont) { return cont(x) + cont(x + 1); } }
+	}
+};
+
+// Never performed. Gives the body its own frame.
+Handler<int, int> inner_handler{
+	{ inner_effect, [](int x) { return x; } }
+};
+
+// Count occurrences of "find" in "in".
+static size_t occurrences(const std::string &in, const std::string &find) {
+	size_t count = 0;
+	for (size_t at = in.find(find); at != std::string::npos; at = in.find(find, at + 1))
+		count++;
+	return count;
+}
+
+// Check the number of occurrences of "find".
+static bool check(const std::string &in, const std::string &find, size_t expected) {
+	size_t count = occurrences(in, find);
+	std::cout << find << ": " << count << std::endl;
+	if (count != expected) {
+		std::cout << "  expected " << expected << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// Get the value of "name" in an event, or an empty string.
+static std::string field(const std::string &event, const std::string &name) {
+	std::string find = "\"" + name + "\": ";
+	size_t at = event.find(find);
+	if (at == std::string::npos)
+		return "";
+	at += find.size();
+	return event.substr(at, event.find_first_of(",}", at) - at);
+}
+
+// Check that each span is started once and ended once, and that there are "expected" spans. Also
+// find out if the spans nest, i.e. if each span ends before the spans started outside of it.
+static bool check_spans(const std::string &in, size_t expected, bool &nested) {
+	std::map<std::string, int> state;
+	std::vector<std::string> open;
+	bool paired = true;
+	nested = true;
+
+	std::istringstream lines(in);
+	std::string event;
+	while (std::getline(lines, event)) {
+		std::string phase = field(event, "ph");
+		if (phase != "\"b\"" && phase != "\"e\"")
+			continue;
+
+		std::string span = field(event, "cat") + " " + field(event, "name") + " " + field(event, "id");
+		if (phase == "\"b\"") {
+			paired &= state[span]++ == 0;
+			open.push_back(span);
+		} else {
+			paired &= state[span]++ == 1;
+			nested &= !open.empty() && open.back() == span;
+			if (!open.empty())
+				open.pop_back();
+		}
+	}
+
+	for (const auto &span : state)
+		paired &= span.second == 2;
+
+	std::cout << "Spans: " << state.size() << (paired ? ", paired" : ", not paired") << (nested ? ", nested" : ", not nested") << std::endl;
+	return paired && state.size() == expected;
+}
+
+static int run() {
+	return handle(handler, []() {
+		int x = tail_effect(1);
+		x = one_shot_effect(+x);
+		return multi_shot_effect(+x);
+	});
+}
+
+// The body of an inner handler performs the effect of an outer handler. The clause resumes the
+// body, so the inner handler returns while the clause is still running.
+static int run_nested() {
+	return handle(handler, []() {
+		return handle(inner_handler, []() {
+			return one_shot_effect(1);
+		});
+	});
+}
+
+int main() {
+	bool ok = true;
+
+	if (std::string(tail_effect.name()) != "tail" || effect_name(tail_effect.id()) != tail_effect.name()) {
+		std::cout << "Wrong effect name" << std::endl;
+		ok = false;
+	}
+
+	// Nothing is recorded until tracing is started.
+	run();
+
+	trace_start();
+	run();
+	trace_stop();
+
+	// Nor after it is stopped.
+	run();
+
+	std::ostringstream out;
+	trace_flush(out);
+	std::string trace = out.str();
+
+#ifndef EFFECTS_NO_TRACE
+	ok &= check(trace, "\"name\": \"handle\"", 2);
+	ok &= check(trace, "\"cat\": \"perform\"", 3);
+	ok &= check(trace, "\"cat\": \"clause\", \"name\": \"tail\"", 2);
+	ok &= check(trace, "\"cat\": \"clause\", \"name\": \"one-shot\"", 2);
+	ok &= check(trace, "\"cat\": \"clause\", \"name\": \"multi-shot\"", 2);
+	ok &= check(trace, "\"name\": \"capture\"", 2);
+	ok &= check(trace, "\"name\": \"resume\"", 3);
+	ok &= check(trace, "\"name\": \"relink\"", 3);
+
+	// One handle and one clause per effect.
+	bool nested = false;
+	ok &= check_spans(trace, 4, nested);
+#endif
+
+	// Flushing discards the events.
+	std::ostringstream again;
+	trace_flush(again);
+	ok &= check(again.str(), "\"ph\"", 0);
+
+	// Spans are paired by their ID, even when they do not nest.
+	trace_start();
+	run_nested();
+	trace_stop();
+
+	std::ostringstream nested_out;
+	trace_flush(nested_out);
+
+#ifndef EFFECTS_NO_TRACE
+	ok &= check_spans(nested_out.str(), 3, nested);
+	if (nested) {
+		std::cout << "Expected the spans not to nest" << std::endl;
+		ok = false;
+	}
+#endif
+
+	return ok ? 0 : 1;
+}